@@ -0,0 +1,200 @@
+/* Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// GraphBuilder describes a DAG of copy, fill, kernel and host-task nodes
+// once and runs it three ways: as eager submissions on a queue with event
+// dependencies, as a graph recorded from those same submissions, or as a
+// graph built node by node with command_graph::add and explicit edges.
+//
+// Nodes are added in topological order and name their dependencies, which
+// must already exist. Command-group functions are stored and invoked again
+// for every emission, so kernels must capture their arguments by value.
+
+#ifndef GRAPH_BUILDER_H
+#define GRAPH_BUILDER_H
+
+#include <sycl/sycl.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+class GraphBuilder {
+ public:
+  using CommandGroup = std::function<void(sycl::handler &)>;
+  using Graph = sycl::ext::oneapi::experimental::command_graph<
+      sycl::ext::oneapi::experimental::graph_state::modifiable>;
+
+  enum class NodeKind { Copy, Fill, Kernel, HostTask };
+
+  struct Node {
+    std::string name;
+    NodeKind kind;
+    CommandGroup cgf;
+    std::vector<size_t> deps;
+  };
+
+  GraphBuilder &copy(const std::string &name, void *dst, const void *src,
+                     size_t bytes, const std::vector<std::string> &deps = {}) {
+    return add(name, NodeKind::Copy,
+               [=](sycl::handler &cgh) { cgh.memcpy(dst, src, bytes); }, deps);
+  }
+
+  template <typename T>
+  GraphBuilder &fill(const std::string &name, T *ptr, const T &value,
+                     size_t count, const std::vector<std::string> &deps = {}) {
+    return add(name, NodeKind::Fill,
+               [=](sycl::handler &cgh) { cgh.fill(ptr, value, count); }, deps);
+  }
+
+  GraphBuilder &kernel(const std::string &name, CommandGroup cgf,
+                       const std::vector<std::string> &deps = {}) {
+    return add(name, NodeKind::Kernel, std::move(cgf), deps);
+  }
+
+  GraphBuilder &hostTask(const std::string &name, std::function<void()> fn,
+                         const std::vector<std::string> &deps = {}) {
+    return add(name, NodeKind::HostTask,
+               [=](sycl::handler &cgh) { cgh.host_task(fn); }, deps);
+  }
+
+  const std::vector<Node> &nodes() const { return nodes_; }
+
+  // Submits every node to q, each waiting on the events of its
+  // dependencies; nodes without dependencies wait on after instead, which
+  // lets successive runs be chained. The returned events are indexed like
+  // nodes().
+  std::vector<sycl::event> runEager(
+      sycl::queue &q, const std::vector<sycl::event> &after = {}) const {
+    std::vector<sycl::event> events;
+    events.reserve(nodes_.size());
+    for (const Node &node : nodes_) {
+      std::vector<sycl::event> deps;
+      if (node.deps.empty()) deps = after;
+      for (size_t d : node.deps) deps.push_back(events[d]);
+      events.push_back(q.submit([&](sycl::handler &cgh) {
+        cgh.depends_on(deps);
+        node.cgf(cgh);
+      }));
+    }
+    return events;
+  }
+
+  // Writes the description as a DOT digraph. When durations (indexed like
+  // nodes()) are given they are added to the node labels.
+  void writeDot(std::ostream &os,
+                const std::vector<double> &durations = {}) const {
+    static const char *kindNames[] = {"copy", "fill", "kernel", "host_task"};
+    os << "digraph GraphBuilder {\n";
+    for (size_t i = 0; i < nodes_.size(); i++) {
+      os << "  n" << i << " [label=\"" << nodes_[i].name << "\\n"
+         << kindNames[int(nodes_[i].kind)];
+      if (i < durations.size()) os << "\\n" << durations[i] << " ms";
+      os << "\"];\n";
+    }
+    for (size_t i = 0; i < nodes_.size(); i++)
+      for (size_t d : nodes_[i].deps)
+        os << "  n" << d << " -> n" << i << ";\n";
+    os << "}\n";
+  }
+
+  // Length of the longest path through the DAG with each node weighted by
+  // durations (indexed like nodes()). The nodes on that path are stored in
+  // path, first to last, when it is not null.
+  double criticalPath(const std::vector<double> &durations,
+                      std::vector<size_t> *path = nullptr) const {
+    std::vector<double> finish(nodes_.size(), 0.0);
+    std::vector<size_t> via(nodes_.size(), SIZE_MAX);
+    size_t last = SIZE_MAX;
+    for (size_t i = 0; i < nodes_.size(); i++) {
+      double start = 0.0;
+      for (size_t d : nodes_[i].deps) {
+        if (finish[d] > start || via[i] == SIZE_MAX) {
+          start = std::max(start, finish[d]);
+          via[i] = d;
+        }
+      }
+      finish[i] = start + durations[i];
+      if (last == SIZE_MAX || finish[i] > finish[last]) last = i;
+    }
+    if (path) {
+      path->clear();
+      for (size_t i = last; i != SIZE_MAX; i = via[i])
+        path->insert(path->begin(), i);
+    }
+    return last == SIZE_MAX ? 0.0 : finish[last];
+  }
+
+  // Records the eager submissions on q into a new graph.
+  Graph record(sycl::queue &q) const {
+    Graph graph(q.get_context(), q.get_device());
+    graph.begin_recording(q);
+    runEager(q);
+    graph.end_recording();
+    return graph;
+  }
+
+  // Adds every node to a new graph and connects it to its dependencies.
+  Graph build(const sycl::context &ctx, const sycl::device &dev) const {
+    Graph graph(ctx, dev);
+    std::vector<sycl::ext::oneapi::experimental::node> graphNodes;
+    graphNodes.reserve(nodes_.size());
+    for (const Node &node : nodes_) {
+      graphNodes.push_back(graph.add(node.cgf));
+      for (size_t d : node.deps)
+        graph.make_edge(graphNodes[d], graphNodes.back());
+    }
+    return graph;
+  }
+
+ private:
+  GraphBuilder &add(const std::string &name, NodeKind kind, CommandGroup cgf,
+                    const std::vector<std::string> &deps) {
+    if (index_.count(name))
+      throw std::invalid_argument("GraphBuilder: duplicate node " + name);
+    Node node{name, kind, std::move(cgf), {}};
+    for (const std::string &dep : deps) {
+      auto it = index_.find(dep);
+      if (it == index_.end())
+        throw std::invalid_argument("GraphBuilder: node " + name +
+                                    " depends on unknown node " + dep);
+      node.deps.push_back(it->second);
+    }
+    index_[name] = nodes_.size();
+    nodes_.push_back(std::move(node));
+    return *this;
+  }
+
+  std::vector<Node> nodes_;
+  std::map<std::string, size_t> index_;
+};
+
+#endif  // GRAPH_BUILDER_H
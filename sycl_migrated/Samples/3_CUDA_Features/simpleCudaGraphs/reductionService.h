@@ -0,0 +1,314 @@
+/* Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of NVIDIA CORPORATION nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// ReductionService accepts sum requests over a Unix domain socket and hands
+// them to an executor in batches. Requests that arrive close together are
+// coalesced: a batch is closed when it reaches maxBatchRequests or
+// maxBatchElements, or when its oldest request has waited maxBatchDelay,
+// so the delay bounds the latency added to buy larger batches.
+//
+// The protocol is a uint32_t element count followed by that many floats;
+// the reply is one double, NaN if the request was larger than a batch.
+// Each connection is served by its own reader thread, which closes the
+// connection once its replies are written, and a single batcher thread
+// calls the executor, so executors need not be thread-safe.
+
+#ifndef REDUCTION_SERVICE_H
+#define REDUCTION_SERVICE_H
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+class ReductionService {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Request {
+    int fd;
+    std::vector<float> data;
+    double result;
+    Clock::time_point arrival;
+  };
+
+  // Fills in result for every request of the batch.
+  using Executor = std::function<void(std::vector<Request> &batch)>;
+
+  ReductionService(const std::string &path, Executor executor,
+                   std::chrono::microseconds maxBatchDelay,
+                   size_t maxBatchRequests, size_t maxBatchElements)
+      : path_(path), executor_(std::move(executor)),
+        maxBatchDelay_(maxBatchDelay), maxBatchRequests_(maxBatchRequests),
+        maxBatchElements_(maxBatchElements) {
+    listenFd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd_ < 0) throw std::runtime_error(error("socket"));
+    sockaddr_un addr = address(path_);
+    unlink(path_.c_str());
+    if (bind(listenFd_, (sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(listenFd_, SOMAXCONN) < 0) {
+      std::string message = error("bind " + path_);
+      close(listenFd_);
+      throw std::runtime_error(message);
+    }
+    batcher_ = std::thread(&ReductionService::batchLoop, this);
+    acceptor_ = std::thread(&ReductionService::acceptLoop, this);
+  }
+
+  ~ReductionService() {
+    shutdown(listenFd_, SHUT_RDWR);
+    close(listenFd_);
+    acceptor_.join();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+      for (auto &client : clients_) shutdown(client.first, SHUT_RDWR);
+    }
+    ready_.notify_all();
+    for (auto &reader : readers_) reader.second.join();
+    batcher_.join();
+    unlink(path_.c_str());
+  }
+
+  ReductionService(const ReductionService &) = delete;
+  ReductionService &operator=(const ReductionService &) = delete;
+
+  // Number of batches executed and requests served so far.
+  size_t batches() const { return batches_; }
+  size_t served() const { return served_; }
+
+  // Client side: connects to the service listening at path.
+  static int connectTo(const std::string &path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) throw std::runtime_error(error("socket"));
+    sockaddr_un addr = address(path);
+    if (connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0) {
+      std::string message = error("connect " + path);
+      close(fd);
+      throw std::runtime_error(message);
+    }
+    return fd;
+  }
+
+  // Client side: sends one request on fd and waits for its sum.
+  static double request(int fd, const float *data, uint32_t count) {
+    double result;
+    if (!writeAll(fd, &count, sizeof(count)) ||
+        !writeAll(fd, data, sizeof(float) * count) ||
+        !readAll(fd, &result, sizeof(result)))
+      throw std::runtime_error(error("request"));
+    return result;
+  }
+
+ private:
+  static std::string error(const std::string &what) {
+    return "ReductionService: " + what + ": " + strerror(errno);
+  }
+
+  static sockaddr_un address(const std::string &path) {
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+      throw std::invalid_argument("ReductionService: socket path too long");
+    strcpy(addr.sun_path, path.c_str());
+    return addr;
+  }
+
+  static bool readAll(int fd, void *buf, size_t bytes) {
+    char *p = (char *)buf;
+    while (bytes > 0) {
+      ssize_t n = read(fd, p, bytes);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      p += n;
+      bytes -= n;
+    }
+    return true;
+  }
+
+  // Reads and drops bytes from fd without buffering them all.
+  static bool discard(int fd, size_t bytes) {
+    char buf[4096];
+    while (bytes > 0) {
+      size_t n = std::min(bytes, sizeof(buf));
+      if (!readAll(fd, buf, n)) return false;
+      bytes -= n;
+    }
+    return true;
+  }
+
+  static bool writeAll(int fd, const void *buf, size_t bytes) {
+    const char *p = (const char *)buf;
+    while (bytes > 0) {
+      ssize_t n = send(fd, p, bytes, MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      p += n;
+      bytes -= n;
+    }
+    return true;
+  }
+
+  void acceptLoop() {
+    for (;;) {
+      int fd = accept(listenFd_, nullptr, nullptr);
+      if (fd < 0) {
+        if (errno == EINTR || errno == ECONNABORTED) continue;
+        return;
+      }
+      std::vector<std::thread> exited;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) {
+          close(fd);
+          return;
+        }
+        for (size_t id : finished_) {
+          exited.push_back(std::move(readers_[id]));
+          readers_.erase(id);
+        }
+        finished_.clear();
+        clients_[fd] = 0;
+        size_t id = nextReader_++;
+        readers_[id] = std::thread(&ReductionService::readLoop, this, fd, id);
+      }
+      for (auto &reader : exited) reader.join();
+    }
+  }
+
+  void readLoop(int fd, size_t id) {
+    uint32_t count;
+    while (readAll(fd, &count, sizeof(count))) {
+      // Oversized requests are rejected before anything is allocated for
+      // them; their payload is skipped to keep the stream in step, and the
+      // NaN waits for the replies to earlier requests so replies stay in
+      // request order.
+      if (count > maxBatchElements_) {
+        if (!discard(fd, sizeof(float) * size_t(count))) break;
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          replied_.wait(lock, [&] { return clients_[fd] == 0; });
+        }
+        double nan = std::numeric_limits<double>::quiet_NaN();
+        std::lock_guard<std::mutex> lock(writeMutex_);
+        writeAll(fd, &nan, sizeof(nan));
+        continue;
+      }
+      Request req{fd, std::vector<float>(count), 0.0, Clock::now()};
+      if (!readAll(fd, req.data.data(), sizeof(float) * count)) break;
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stopping_) break;
+      clients_[fd]++;
+      pendingElements_ += count;
+      pending_.push_back(std::move(req));
+      ready_.notify_one();
+    }
+
+    // The batcher still writes replies to fd until its requests are done.
+    std::unique_lock<std::mutex> lock(mutex_);
+    replied_.wait(lock, [&] { return clients_[fd] == 0; });
+    clients_.erase(fd);
+    finished_.push_back(id);
+    close(fd);
+  }
+
+  void batchLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      ready_.wait(lock, [&] { return stopping_ || !pending_.empty(); });
+      if (pending_.empty()) return;
+
+      ready_.wait_until(lock, pending_.front().arrival + maxBatchDelay_, [&] {
+        return stopping_ || pending_.size() >= maxBatchRequests_ ||
+               pendingElements_ >= maxBatchElements_;
+      });
+
+      std::vector<Request> batch;
+      size_t elements = 0;
+      while (!pending_.empty() && batch.size() < maxBatchRequests_ &&
+             elements + pending_.front().data.size() <= maxBatchElements_) {
+        elements += pending_.front().data.size();
+        batch.push_back(std::move(pending_.front()));
+        pending_.pop_front();
+      }
+      pendingElements_ -= elements;
+      lock.unlock();
+
+      executor_(batch);
+      batches_++;
+      served_ += batch.size();
+      {
+        std::lock_guard<std::mutex> writeLock(writeMutex_);
+        for (Request &req : batch)
+          writeAll(req.fd, &req.result, sizeof(req.result));
+      }
+      lock.lock();
+      for (Request &req : batch) clients_[req.fd]--;
+      replied_.notify_all();
+    }
+  }
+
+  std::string path_;
+  Executor executor_;
+  std::chrono::microseconds maxBatchDelay_;
+  size_t maxBatchRequests_, maxBatchElements_;
+
+  int listenFd_;
+  std::thread acceptor_, batcher_;
+  // Reader threads by id; readers that have exited put their id in
+  // finished_ and are joined by the acceptor.
+  std::map<size_t, std::thread> readers_;
+  std::vector<size_t> finished_;
+  size_t nextReader_ = 0;
+  // Open connections and the number of their requests awaiting a reply.
+  std::map<int, size_t> clients_;
+
+  std::mutex mutex_, writeMutex_;
+  std::condition_variable ready_, replied_;
+  std::deque<Request> pending_;
+  size_t pendingElements_ = 0;
+  bool stopping_ = false;
+  std::atomic<size_t> batches_{0}, served_{0};
+};
+
+#endif  // REDUCTION_SERVICE_H
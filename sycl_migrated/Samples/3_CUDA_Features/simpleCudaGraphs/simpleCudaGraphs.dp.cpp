@@ -32,39 +32,105 @@
 #include <helper_cuda.h>
 #include <vector>
 #include <chrono>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <fstream>
+#include <optional>
+#include <map>
+#include <filesystem>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <cmath>
+#include <type_traits>
+
+#include "graphBuilder.h"
+#include "reductionService.h"
 
 using Time = std::chrono::steady_clock;
 using ms = std::chrono::milliseconds;
 using float_ms = std::chrono::duration<float, ms::period>;
+using exec_graph_t = sycl::ext::oneapi::experimental::command_graph<
+    sycl::ext::oneapi::experimental::graph_state::executable>;
+using exec_bundle_t = sycl::kernel_bundle<sycl::bundle_state::executable>;
 
 /* DPCT_ORIG namespace cg = cooperative_groups;*/
 
 #define THREADS_PER_BLOCK 256
 #define GRAPH_LAUNCH_ITERATIONS 3
+#define HISTOGRAM_BINS 256
+#define TOPK_RADIX_BITS 8
+#define TOPK_RADIX_BINS (1 << TOPK_RADIX_BITS)
+#define TOPK_PASSES (32 / TOPK_RADIX_BITS)
+#define TOPK_MAX 1024
+#define RESULT_RING_SLOTS 64
+#define WORK_RING_SLOTS 64
+#define WORK_EMPTY 0u
+#define WORK_POSTED 1u
+#define WORK_DONE 2u
+#define PERSISTENT_JOBS 1000
+#define PERSISTENT_MAX_JOB (1 << 16)
+#define PERSISTENT_TIMEOUT_MS 5000
+#define PACKED_BITS 12
+#define DELTA_BLOCK 256
 
 typedef struct callBackData {
   const char *fn_name;
   double *data;
 } callBackData_t;
 
+// Iterations run by every execution mode, set from -iterations.
+int graphLaunchIterations = GRAPH_LAUNCH_ITERATIONS;
+
+// Device selected in main(); every execution mode creates its queues on it.
+std::optional<sycl::device> targetDevice;
+
+// How the queues of an execution mode are created. A zero-initialized
+// config gives the default out-of-order queues.
+typedef struct queueConfig {
+  bool inOrder;
+  bool immediateCommandList;
+} queueConfig_t;
+
+// Launch costs of an execution mode.
+typedef struct launchStats {
+  float setup_ms;   // queue creation plus graph construction and finalize
+  float submit_us;  // host time spent in submission calls
+  float first_ms;   // first iteration, submission to completion
+  float total_ms;   // all iterations, submission to completion
+  int iterations;
+  size_t nodes;     // nodes in the graph, 0 for eager submission
+} launchStats_t;
+
 /* DPCT_ORIG __global__ void reduce(float *inputVec, double *outputVec, size_t
    inputSize, size_t outputSize) {*/
-void reduce(float *inputVec, double *outputVec, size_t inputSize,
-            size_t outputSize, const sycl::nd_item<3> &item_ct1, double *tmp) {
+// reduce() over values produced by load(i) for i in [0, inputSize), so the
+// load stage can decode its input in registers. Each work-item accumulates
+// its grid-stride share in Acc; the shares are combined in double.
+template <typename Acc, typename Loader>
+void reduceWith(Loader load, double *outputVec, size_t inputSize,
+                size_t outputSize, const sycl::nd_item<3> &item_ct1,
+                double *tmp, size_t gridSize = 0, int blockSize = 0) {
+  // Launch shape, taken from item_ct1 unless passed in as constants the
+  // compiler can fold.
+  size_t localRange = blockSize ? blockSize : item_ct1.get_local_range(2);
+  size_t gridRange = gridSize ? gridSize : item_ct1.get_group_range(2);
+
 /* DPCT_ORIG   __shared__ double tmp[THREADS_PER_BLOCK];*/
 
 /* DPCT_ORIG   cg::thread_block cta = cg::this_thread_block();*/
   auto cta = item_ct1.get_group();
 /* DPCT_ORIG   size_t globaltid = blockIdx.x * blockDim.x + threadIdx.x;*/
-  size_t globaltid = item_ct1.get_group(2) * item_ct1.get_local_range(2) +
+  size_t globaltid = item_ct1.get_group(2) * localRange +
                      item_ct1.get_local_id(2);
 
-  double temp_sum = 0.0;
+  Acc temp_sum = 0;
 /* DPCT_ORIG   for (int i = globaltid; i < inputSize; i += gridDim.x *
  * blockDim.x) {*/
   for (int i = globaltid; i < inputSize;
-       i += item_ct1.get_group_range(2) * item_ct1.get_local_range(2)) {
-    temp_sum += (double)inputVec[i];
+       i += gridRange * localRange) {
+    temp_sum += static_cast<Acc>(load(i));
   }
 /* DPCT_ORIG   tmp[cta.thread_rank()] = temp_sum;*/
   tmp[item_ct1.get_local_linear_id()] = temp_sum;
@@ -116,7 +182,7 @@ void reduce(float *inputVec, double *outputVec, size_t inputSize,
       item_ct1.get_group(2) < outputSize) {
     beta = 0.0;
 /* DPCT_ORIG     for (int i = 0; i < cta.size(); i += tile32.size()) {*/
-    for (int i = 0; i < item_ct1.get_group().get_local_linear_range();
+    for (int i = 0; i < localRange;
          i += item_ct1.get_sub_group().get_local_linear_range()) {
       beta += tmp[i];
     }
@@ -125,23 +191,108 @@ void reduce(float *inputVec, double *outputVec, size_t inputSize,
   }
 }
 
+// T is the input element type, read through float, and Acc the type each
+// work-item accumulates its grid-stride share in.
+template <typename T, typename Acc = double>
+void reduce(T *inputVec, double *outputVec, size_t inputSize,
+            size_t outputSize, const sycl::nd_item<3> &item_ct1, double *tmp) {
+  reduceWith<Acc>(
+      [=](size_t i) { return static_cast<float>(inputVec[i]); }, outputVec,
+      inputSize, outputSize, item_ct1, tmp);
+}
+
+// Compressed integer counter formats that reduceWith() sums without
+// materializing the decoded array. Each loader yields one addend per unit:
+// an element for bit-packed input, a whole block for delta blocks, and
+// value * length for an RLE run.
+typedef struct deltaBlock {
+  unsigned int base;                // value of the first element
+  signed char deltas[DELTA_BLOCK];  // element j is base + deltas[0..j]
+} deltaBlock_t;
+
+typedef struct rleRun {
+  unsigned int value;
+  unsigned int length;
+} rleRun_t;
+
+// PACKED_BITS-bit values packed back to back into 32-bit words, followed
+// by one pad word so every value can be read from a 64-bit window.
+struct bitPackedLoader {
+  const unsigned int *words;
+
+  double operator()(size_t i) const {
+    size_t bit = i * PACKED_BITS;
+    unsigned long long window =
+        words[bit / 32] | (unsigned long long)words[bit / 32 + 1] << 32;
+    return (window >> (bit % 32)) & ((1u << PACKED_BITS) - 1);
+  }
+};
+
+// Decodes a whole block in registers. Every work-item walks its own
+// block, so loads are strided across the sub-group.
+struct deltaLoader {
+  const deltaBlock_t *blocks;
+  size_t elements;
+
+  double operator()(size_t b) const {
+    size_t n = sycl::min(size_t(DELTA_BLOCK), elements - b * DELTA_BLOCK);
+    int value = blocks[b].base;
+    double sum = 0.0;
+    for (size_t j = 0; j < n; j++) {
+      value += blocks[b].deltas[j];
+      sum += value;
+    }
+    return sum;
+  }
+};
+
+struct rleLoader {
+  const rleRun_t *runs;
+
+  double operator()(size_t r) const {
+    return (double)runs[r].value * runs[r].length;
+  }
+};
+
+// reduce() for graphs without a fill node in front of it: besides the
+// partial of every work-group it zeroes outputVec[groups, outputSize), so
+// all outputSize partials are written by the kernel whatever the launch
+// size.
+template <typename T, typename Acc = double>
+void reduceInitOutput(T *inputVec, double *outputVec, size_t inputSize,
+                      size_t outputSize, const sycl::nd_item<3> &item_ct1,
+                      double *tmp) {
+  size_t globaltid = item_ct1.get_group(2) * item_ct1.get_local_range(2) +
+                     item_ct1.get_local_id(2);
+  for (size_t i = item_ct1.get_group_range(2) + globaltid; i < outputSize;
+       i += item_ct1.get_group_range(2) * item_ct1.get_local_range(2)) {
+    outputVec[i] = 0.0;
+  }
+  reduce<T, Acc>(inputVec, outputVec, inputSize, outputSize, item_ct1, tmp);
+}
+
 /* DPCT_ORIG __global__ void reduceFinal(double *inputVec, double *result,
                             size_t inputSize) {*/
 void reduceFinal(double *inputVec, double *result, size_t inputSize,
-                 const sycl::nd_item<3> &item_ct1, double *tmp) {
+                 const sycl::nd_item<3> &item_ct1, double *tmp,
+                 int blockSize = 0) {
+  // Work-group size, taken from item_ct1 unless passed in as a constant the
+  // compiler can fold the combine ladder below with.
+  size_t localRange = blockSize ? blockSize : item_ct1.get_local_range(2);
+
 /* DPCT_ORIG   __shared__ double tmp[THREADS_PER_BLOCK];*/
 
 /* DPCT_ORIG   cg::thread_block cta = cg::this_thread_block();*/
   auto cta = item_ct1.get_group();
 /* DPCT_ORIG   size_t globaltid = blockIdx.x * blockDim.x + threadIdx.x;*/
-  size_t globaltid = item_ct1.get_group(2) * item_ct1.get_local_range(2) +
+  size_t globaltid = item_ct1.get_group(2) * localRange +
                      item_ct1.get_local_id(2);
 
   double temp_sum = 0.0;
 /* DPCT_ORIG   for (int i = globaltid; i < inputSize; i += gridDim.x *
  * blockDim.x) {*/
   for (int i = globaltid; i < inputSize;
-       i += item_ct1.get_group_range(2) * item_ct1.get_local_range(2)) {
+       i += item_ct1.get_group_range(2) * localRange) {
     temp_sum += (double)inputVec[i];
   }
 /* DPCT_ORIG   tmp[cta.thread_rank()] = temp_sum;*/
@@ -161,7 +312,7 @@ void reduceFinal(double *inputVec, double *result, size_t inputSize,
 
   // do reduction in shared mem
 /* DPCT_ORIG   if ((blockDim.x >= 512) && (cta.thread_rank() < 256)) {*/
-  if ((item_ct1.get_local_range(2) >= 512) &&
+  if ((localRange >= 512) &&
       (item_ct1.get_local_linear_id() < 256)) {
 /* DPCT_ORIG     tmp[cta.thread_rank()] = temp_sum = temp_sum +
  * tmp[cta.thread_rank() + 256];*/
@@ -178,7 +329,7 @@ void reduceFinal(double *inputVec, double *result, size_t inputSize,
   item_ct1.barrier();
 
 /* DPCT_ORIG   if ((blockDim.x >= 256) && (cta.thread_rank() < 128)) {*/
-  if ((item_ct1.get_local_range(2) >= 256) &&
+  if ((localRange >= 256) &&
       (item_ct1.get_local_linear_id() < 128)) {
 /* DPCT_ORIG     tmp[cta.thread_rank()] = temp_sum = temp_sum +
  * tmp[cta.thread_rank() + 128];*/
@@ -195,7 +346,7 @@ void reduceFinal(double *inputVec, double *result, size_t inputSize,
   item_ct1.barrier();
 
 /* DPCT_ORIG   if ((blockDim.x >= 128) && (cta.thread_rank() < 64)) {*/
-  if ((item_ct1.get_local_range(2) >= 128) &&
+  if ((localRange >= 128) &&
       (item_ct1.get_local_linear_id() < 64)) {
 /* DPCT_ORIG     tmp[cta.thread_rank()] = temp_sum = temp_sum +
  * tmp[cta.thread_rank() + 64];*/
@@ -216,7 +367,7 @@ void reduceFinal(double *inputVec, double *result, size_t inputSize,
     // Fetch final intermediate sum from 2nd warp
 /* DPCT_ORIG     if (blockDim.x >= 64) temp_sum += tmp[cta.thread_rank() +
  * 32];*/
-    if (item_ct1.get_local_range(2) >= 64) temp_sum +=
+    if (localRange >= 64) temp_sum +=
         tmp[item_ct1.get_local_linear_id() + 32];
     // Reduce final warp using shuffle
 /* DPCT_ORIG     for (int offset = tile32.size() / 2; offset > 0; offset /= 2)
@@ -233,10 +384,296 @@ void reduceFinal(double *inputVec, double *result, size_t inputSize,
   if (item_ct1.get_local_linear_id() == 0) result[0] = temp_sum;
 }
 
+// Histogram of inputVec over [lo, hi) into HISTOGRAM_BINS bins. Each
+// work-group accumulates into privatized bins in local memory and merges the
+// non-empty ones into the global bins with one atomic per bin, so global
+// atomic traffic is bounded by work-groups * bins rather than inputSize.
+void histogram(const float *inputVec, unsigned int *bins, size_t inputSize,
+               float lo, float hi, const sycl::nd_item<3> &item_ct1,
+               unsigned int *localBins) {
+  for (int b = item_ct1.get_local_linear_id(); b < HISTOGRAM_BINS;
+       b += item_ct1.get_local_range(2)) {
+    localBins[b] = 0;
+  }
+  item_ct1.barrier(sycl::access::fence_space::local_space);
+
+  size_t globaltid = item_ct1.get_group(2) * item_ct1.get_local_range(2) +
+                     item_ct1.get_local_id(2);
+  float scale = HISTOGRAM_BINS / (hi - lo);
+
+  for (size_t i = globaltid; i < inputSize;
+       i += item_ct1.get_group_range(2) * item_ct1.get_local_range(2)) {
+    int b = sycl::clamp((int)((inputVec[i] - lo) * scale), 0,
+                        HISTOGRAM_BINS - 1);
+    sycl::atomic_ref<unsigned int, sycl::memory_order::relaxed,
+                     sycl::memory_scope::work_group,
+                     sycl::access::address_space::local_space>
+        bin(localBins[b]);
+    bin.fetch_add(1u);
+  }
+  item_ct1.barrier(sycl::access::fence_space::local_space);
+
+  for (int b = item_ct1.get_local_linear_id(); b < HISTOGRAM_BINS;
+       b += item_ct1.get_local_range(2)) {
+    if (localBins[b] == 0) continue;
+    sycl::atomic_ref<unsigned int, sycl::memory_order::relaxed,
+                     sycl::memory_scope::device,
+                     sycl::access::address_space::global_space>
+        bin(bins[b]);
+    bin.fetch_add(localBins[b]);
+  }
+}
+
+// Top-K selection is a radix select over the float keys: each pass
+// histograms one TOPK_RADIX_BITS digit of the keys that still match the
+// selected prefix, and a single work-item picks the digit holding the K-th
+// largest key. After all passes the prefix is exactly the K-th largest key
+// and a gather pass copies everything above it plus enough ties.
+typedef struct topKState {
+  unsigned int prefix;      // key digits of the K-th largest selected so far
+  unsigned int mask;        // which bits of prefix are valid
+  unsigned int remaining;   // how many of the K fall inside the prefix
+  unsigned int countAbove;  // gather cursor for keys above the K-th key
+  unsigned int countEqual;  // gather cursor for keys equal to the K-th key
+} topKState_t;
+
+// Maps a float to an unsigned key with the same ordering.
+inline unsigned int orderedKey(float v) {
+  unsigned int bits = sycl::bit_cast<unsigned int>(v);
+  return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+}
+
+void topKInit(topKState_t *state, unsigned int k) {
+  state->prefix = 0;
+  state->mask = 0;
+  state->remaining = k;
+  state->countAbove = 0;
+  state->countEqual = 0;
+}
+
+void topKRadixHistogram(const float *inputVec, size_t inputSize,
+                        const topKState_t *state, unsigned int *bins,
+                        int shift, const sycl::nd_item<3> &item_ct1,
+                        unsigned int *localBins) {
+  for (int b = item_ct1.get_local_linear_id(); b < TOPK_RADIX_BINS;
+       b += item_ct1.get_local_range(2)) {
+    localBins[b] = 0;
+  }
+  item_ct1.barrier(sycl::access::fence_space::local_space);
+
+  unsigned int prefix = state->prefix;
+  unsigned int mask = state->mask;
+  size_t globaltid = item_ct1.get_group(2) * item_ct1.get_local_range(2) +
+                     item_ct1.get_local_id(2);
+
+  for (size_t i = globaltid; i < inputSize;
+       i += item_ct1.get_group_range(2) * item_ct1.get_local_range(2)) {
+    unsigned int key = orderedKey(inputVec[i]);
+    if ((key & mask) != prefix) continue;
+    sycl::atomic_ref<unsigned int, sycl::memory_order::relaxed,
+                     sycl::memory_scope::work_group,
+                     sycl::access::address_space::local_space>
+        bin(localBins[(key >> shift) & (TOPK_RADIX_BINS - 1)]);
+    bin.fetch_add(1u);
+  }
+  item_ct1.barrier(sycl::access::fence_space::local_space);
+
+  for (int b = item_ct1.get_local_linear_id(); b < TOPK_RADIX_BINS;
+       b += item_ct1.get_local_range(2)) {
+    if (localBins[b] == 0) continue;
+    sycl::atomic_ref<unsigned int, sycl::memory_order::relaxed,
+                     sycl::memory_scope::device,
+                     sycl::access::address_space::global_space>
+        bin(bins[b]);
+    bin.fetch_add(localBins[b]);
+  }
+}
+
+void topKSelectDigit(topKState_t *state, const unsigned int *bins, int shift) {
+  unsigned int remaining = state->remaining;
+  unsigned int above = 0;
+  int d = TOPK_RADIX_BINS - 1;
+  for (; d > 0; d--) {
+    if (above + bins[d] >= remaining) break;
+    above += bins[d];
+  }
+  state->prefix |= (unsigned int)d << shift;
+  state->mask |= (unsigned int)(TOPK_RADIX_BINS - 1) << shift;
+  state->remaining = remaining - above;
+}
+
+void topKGather(const float *inputVec, size_t inputSize, topKState_t *state,
+                float *topK, unsigned int k,
+                const sycl::nd_item<3> &item_ct1) {
+  unsigned int kth = state->prefix;
+  unsigned int ties = state->remaining;
+  size_t globaltid = item_ct1.get_group(2) * item_ct1.get_local_range(2) +
+                     item_ct1.get_local_id(2);
+
+  for (size_t i = globaltid; i < inputSize;
+       i += item_ct1.get_group_range(2) * item_ct1.get_local_range(2)) {
+    float v = inputVec[i];
+    unsigned int key = orderedKey(v);
+    if (key > kth) {
+      sycl::atomic_ref<unsigned int, sycl::memory_order::relaxed,
+                       sycl::memory_scope::device,
+                       sycl::access::address_space::global_space>
+          cursor(state->countAbove);
+      topK[cursor.fetch_add(1u)] = v;
+    } else if (key == kth) {
+      sycl::atomic_ref<unsigned int, sycl::memory_order::relaxed,
+                       sycl::memory_scope::device,
+                       sycl::access::address_space::global_space>
+          cursor(state->countEqual);
+      unsigned int slot = cursor.fetch_add(1u);
+      if (slot < ties) topK[k - ties + slot] = v;
+    }
+  }
+}
+
+// Results published by graph replays into host USM. Replay n writes
+// slots[n % RESULT_RING_SLOTS] and then bumps completed with release
+// semantics, so the host can poll completed and read every slot below it
+// without waiting on the queue.
+typedef struct resultRing {
+  double slots[RESULT_RING_SLOTS];
+  unsigned long long completed;
+} resultRing_t;
+
+void publishResult(const double *result, resultRing_t *ring) {
+  sycl::atomic_ref<unsigned long long, sycl::memory_order::relaxed,
+                   sycl::memory_scope::system,
+                   sycl::access::address_space::global_space>
+      completed(ring->completed);
+  unsigned long long seq = completed.load();
+  ring->slots[seq % RESULT_RING_SLOTS] = result[0];
+  completed.store(seq + 1, sycl::memory_order::release);
+}
+
+// Preprocessing stage for the composed pipeline: scales the staged input
+// into the buffer the reduction reads.
+void scaleInput(const float *inputVec, float *outputVec, size_t inputSize,
+                float scale, const sycl::nd_item<3> &item_ct1) {
+  size_t globaltid = item_ct1.get_group(2) * item_ct1.get_local_range(2) +
+                     item_ct1.get_local_id(2);
+  for (size_t i = globaltid; i < inputSize;
+       i += item_ct1.get_group_range(2) * item_ct1.get_local_range(2)) {
+    outputVec[i] = inputVec[i] * scale;
+  }
+}
+
+// Postprocessing stage for the composed pipeline.
+void computeMean(const double *sum, double *mean, size_t inputSize) {
+  mean[0] = sum[0] / inputSize;
+}
+
+// Sum of input[begin, end) over one work-group: each work-item adds a
+// block-stride share in double and the shares are combined in tmp, which
+// holds the total in tmp[0] for every work-item on return.
+double blockSum(const float *input, size_t begin, size_t end,
+                const sycl::nd_item<3> &item_ct1, double *tmp) {
+  double temp_sum = 0.0;
+  for (size_t i = begin + item_ct1.get_local_id(2); i < end;
+       i += item_ct1.get_local_range(2)) {
+    temp_sum += (double)input[i];
+  }
+  tmp[item_ct1.get_local_linear_id()] = temp_sum;
+  item_ct1.barrier(sycl::access::fence_space::local_space);
+
+  for (int i = item_ct1.get_local_range(2) / 2; i > 0; i >>= 1) {
+    if (item_ct1.get_local_linear_id() < i)
+      tmp[item_ct1.get_local_linear_id()] +=
+          tmp[item_ct1.get_local_linear_id() + i];
+    item_ct1.barrier(sycl::access::fence_space::local_space);
+  }
+  return tmp[0];
+}
+
+// Segmented sum for the reduction service: work-group g sums
+// input[offsets[g], offsets[g + 1]) into results[g]. Groups at or past
+// *segments return at once, so one graph sized for the largest batch
+// replays batches of any size.
+void reduceSegments(const float *input, const unsigned int *offsets,
+                    const unsigned int *segments, double *results,
+                    const sycl::nd_item<3> &item_ct1, double *tmp) {
+  unsigned int segment = item_ct1.get_group(2);
+  if (segment >= *segments) return;
+
+  double sum = blockSum(input, offsets[segment], offsets[segment + 1],
+                        item_ct1, tmp);
+  if (item_ct1.get_local_linear_id() == 0) results[segment] = sum;
+}
+
+// Work ring for the persistent kernel. The host fills a job's input and
+// size and then stores WORK_POSTED to its state with release semantics; the
+// kernel takes jobs in ring order, writes result and stores WORK_DONE. A job
+// with a null input stops the kernel.
+
+typedef struct workJob {
+  const float *input;
+  size_t size;
+  double result;
+  unsigned int state;
+} workJob_t;
+
+typedef struct workRing {
+  workJob_t jobs[WORK_RING_SLOTS];
+} workRing_t;
+
+// Single work-group kernel that never returns until stopped: work-item 0
+// spins on the next job's state, the group sums the job with blockSum, as
+// reduceSegments sums a segment, and work-item 0 publishes the result. The
+// host submits it once and afterwards only writes to the ring.
+void persistentReduce(workRing_t *ring, const sycl::nd_item<3> &item_ct1,
+                      double *tmp) {
+  for (unsigned long long seq = 0;; seq++) {
+    workJob_t *job = &ring->jobs[seq % WORK_RING_SLOTS];
+    sycl::atomic_ref<unsigned int, sycl::memory_order::relaxed,
+                     sycl::memory_scope::system,
+                     sycl::access::address_space::global_space>
+        state(job->state);
+    if (item_ct1.get_local_linear_id() == 0) {
+      while (state.load(sycl::memory_order::acquire) != WORK_POSTED) {
+      }
+    }
+    bool leader = item_ct1.get_local_linear_id() == 0;
+    const float *input = sycl::group_broadcast(
+        item_ct1.get_group(), leader ? job->input : nullptr, 0);
+    size_t size = sycl::group_broadcast(item_ct1.get_group(),
+                                        leader ? job->size : 0, 0);
+    if (!input) return;
+
+    double sum = blockSum(input, 0, size, item_ct1, tmp);
+    if (item_ct1.get_local_linear_id() == 0) {
+      job->result = sum;
+      state.store(WORK_DONE, sycl::memory_order::release);
+    }
+  }
+}
+
 void init_input(float *a, size_t size) {
   for (size_t i = 0; i < size; i++) a[i] = (rand() & 0xFF) / (float)RAND_MAX;
 }
 
+// Same value range as init_input, but hotFraction of the elements land in a
+// single bin to stress atomic contention on the privatized bins.
+void init_input_skewed(float *a, size_t size, float hotFraction) {
+  for (size_t i = 0; i < size; i++) {
+    if (rand() < hotFraction * RAND_MAX)
+      a[i] = 0x80 / (float)RAND_MAX;
+    else
+      a[i] = (rand() & 0xFF) / (float)RAND_MAX;
+  }
+}
+
+// Fractional values spread log-uniformly over [2^-12, 2^12], inside the
+// normal range of sycl::half, so the input formats differ in precision
+// rather than in what they can represent at all.
+void init_input_wide(float *a, size_t size) {
+  for (size_t i = 0; i < size; i++)
+    a[i] = std::exp2(-12.0f + 24.0f * rand() / (float)RAND_MAX);
+}
+
 /* DPCT_ORIG void CUDART_CB myHostNodeCallback(void *data) {*/
 void myHostNodeCallback(void *data) {
   // Check status of GPU after stream operations are done
@@ -249,170 +686,224 @@ void myHostNodeCallback(void *data) {
   *result = 0.0;  // reset the result
 }
 
-void testrun(float *inputVec_h, float *inputVec_d,
-                                  double *outputVec_d, double *result_d,
-                                  size_t inputSize, size_t numOfBlocks) {
-/* DPCT_ORIG   cudaStream_t stream1, stream2, stream3, streamForGraph;*/
-  dpct::queue_ptr stream1, stream2, stream3;
-/* DPCT_ORIG   cudaEvent_t forkStreamEvent, memsetEvent1, memsetEvent2;*/
-  dpct::event_ptr forkStreamEvent, memsetEvent1, memsetEvent2;
+// Command groups launching the sample's kernels with its launch shape:
+// numOfBlocks work-groups of THREADS_PER_BLOCK for the passes over the
+// input, and a single work-group for reduceFinal. They are passed as is to
+// command_graph::add and GraphBuilder, and invoked inside a submit where
+// the command group also needs dependencies. Given a precompiled bundle,
+// reduceCommand and reduceFinalCommand launch their kernel from it.
+template <typename T, typename Acc = double>
+auto reduceCommand(T *inputVec_d, double *outputVec_d, size_t inputSize,
+                   size_t numOfBlocks,
+                   const exec_bundle_t *kernels = nullptr) {
+  return [=](sycl::handler &cgh) {
+    if (kernels) cgh.use_kernel_bundle(*kernels);
+    sycl::local_accessor<double, 1> tmp_acc_ct1(
+      sycl::range<1>(THREADS_PER_BLOCK), cgh);
 
- 
-  double result_h = 0.0;
+    cgh.parallel_for(
+      sycl::nd_range<3>(sycl::range<3>(1, 1, numOfBlocks) *
+                            sycl::range<3>(1, 1, THREADS_PER_BLOCK),
+                        sycl::range<3>(1, 1, THREADS_PER_BLOCK)),
+      [=](sycl::nd_item<3> item_ct1) [[intel::reqd_sub_group_size(32)]] {
+        reduce<T, Acc>(inputVec_d, outputVec_d, inputSize, numOfBlocks,
+                       item_ct1, tmp_acc_ct1.get_pointer());
+      });
+  };
+}
 
-/* DPCT_ORIG   checkCudaErrors(cudaStreamCreate(&stream1));*/
-  stream1 = dpct::get_current_device().create_queue();
-/* DPCT_ORIG   checkCudaErrors(cudaStreamCreate(&stream2));*/
-  stream2 = dpct::get_current_device().create_queue();
-/* DPCT_ORIG   checkCudaErrors(cudaStreamCreate(&stream3));*/
-  stream3 = dpct::get_current_device().create_queue();
-
-/* DPCT_ORIG   checkCudaErrors(cudaEventCreate(&forkStreamEvent));*/
-  forkStreamEvent = new sycl::event();
-/* DPCT_ORIG   checkCudaErrors(cudaEventCreate(&memsetEvent1));*/
-  memsetEvent1 = new sycl::event();
-/* DPCT_ORIG   checkCudaErrors(cudaEventCreate(&memsetEvent2));*/
-  memsetEvent2 = new sycl::event();
-
-/* DPCT_ORIG   checkCudaErrors(cudaStreamBeginCapture(stream1,
- * cudaStreamCaptureModeGlobal));*/
-  /*
-  DPCT1027:42: The call to cudaStreamBeginCapture was replaced with 0 because
-  SYCL currently does not support capture operations on queues.
-  */
+template <typename T, typename Acc = double>
+auto reduceInitOutputCommand(T *inputVec_d, double *outputVec_d,
+                             size_t inputSize, size_t numOfBlocks) {
+  return [=](sycl::handler &cgh) {
+    sycl::local_accessor<double, 1> tmp_acc_ct1(
+      sycl::range<1>(THREADS_PER_BLOCK), cgh);
 
-/* DPCT_ORIG   checkCudaErrors(cudaEventRecord(forkStreamEvent, stream1));*/
-  /*
-  DPCT1012:43: Detected kernel execution time measurement pattern and generated
-  an initial code for time measurements in SYCL. You can change the way time is
-  measured depending on your goals.
-  */
-  /*
-  DPCT1024:44: The original code returned the error code that was further
-  consumed by the program logic. This original code was replaced with 0. You may
-  need to rewrite the program logic consuming the error code.
-  */
-  *forkStreamEvent = stream1->ext_oneapi_submit_barrier();
-/* DPCT_ORIG   checkCudaErrors(cudaStreamWaitEvent(stream2, forkStreamEvent,
- * 0));*/
-  stream2->ext_oneapi_submit_barrier({*forkStreamEvent});
-/* DPCT_ORIG   checkCudaErrors(cudaStreamWaitEvent(stream3, forkStreamEvent,
- * 0));*/
-  stream3->ext_oneapi_submit_barrier({*forkStreamEvent});
-
-/* DPCT_ORIG   checkCudaErrors(cudaMemcpyAsync(inputVec_d, inputVec_h,*/
-  stream1->memcpy(inputVec_d, inputVec_h,
-                                       /* DPCT_ORIG sizeof(float) * inputSize,
-                                          cudaMemcpyDefault, stream1));*/
-                                       sizeof(float) * inputSize);
-
-
-      /* DPCT_ORIG       cudaMemsetAsync(outputVec_d, 0, sizeof(double) *
-         numOfBlocks, stream2));*/
-   stream2->memset(outputVec_d, 0, sizeof(double) * numOfBlocks);
-
-/* DPCT_ORIG   checkCudaErrors(cudaEventRecord(memsetEvent1, stream2));*/
-  /*
-  DPCT1012:45: Detected kernel execution time measurement pattern and generated
-  an initial code for time measurements in SYCL. You can change the way time is
-  measured depending on your goals.
-  */
-  /*
-  DPCT1024:46: The original code returned the error code that was further
-  consumed by the program logic. This original code was replaced with 0. You may
-  need to rewrite the program logic consuming the error code.
-  */
-  *memsetEvent1 = stream2->ext_oneapi_submit_barrier();
+    cgh.parallel_for(
+      sycl::nd_range<3>(sycl::range<3>(1, 1, numOfBlocks) *
+                            sycl::range<3>(1, 1, THREADS_PER_BLOCK),
+                        sycl::range<3>(1, 1, THREADS_PER_BLOCK)),
+      [=](sycl::nd_item<3> item_ct1) [[intel::reqd_sub_group_size(32)]] {
+        reduceInitOutput<T, Acc>(inputVec_d, outputVec_d, inputSize,
+                                 numOfBlocks, item_ct1,
+                                 tmp_acc_ct1.get_pointer());
+      });
+  };
+}
+
+auto reduceFinalCommand(double *outputVec_d, double *result_d,
+                        size_t numOfBlocks,
+                        const exec_bundle_t *kernels = nullptr) {
+  return [=](sycl::handler &cgh) {
+    if (kernels) cgh.use_kernel_bundle(*kernels);
+    sycl::local_accessor<double, 1> tmp_acc_ct1(
+      sycl::range<1>(THREADS_PER_BLOCK), cgh);
+
+    cgh.parallel_for(
+      sycl::nd_range<3>(sycl::range<3>(1, 1, THREADS_PER_BLOCK),
+                        sycl::range<3>(1, 1, THREADS_PER_BLOCK)),
+      [=](sycl::nd_item<3> item_ct1) [[intel::reqd_sub_group_size(32)]] {
+        reduceFinal(outputVec_d, result_d, numOfBlocks, item_ct1,
+                    tmp_acc_ct1.get_pointer());
+      });
+  };
+}
+
+auto histogramCommand(const float *inputVec_d, unsigned int *bins_d,
+                      size_t inputSize, size_t numOfBlocks, float lo,
+                      float hi) {
+  return [=](sycl::handler &cgh) {
+    sycl::local_accessor<unsigned int, 1> bins_acc_ct1(
+      sycl::range<1>(HISTOGRAM_BINS), cgh);
+
+    cgh.parallel_for(
+      sycl::nd_range<3>(sycl::range<3>(1, 1, numOfBlocks) *
+                            sycl::range<3>(1, 1, THREADS_PER_BLOCK),
+                        sycl::range<3>(1, 1, THREADS_PER_BLOCK)),
+      [=](sycl::nd_item<3> item_ct1) {
+        histogram(inputVec_d, bins_d, inputSize, lo, hi, item_ct1,
+                  bins_acc_ct1.get_pointer());
+      });
+  };
+}
+
+// Whether the device honours the Intel command-list queue properties.
+bool commandListSelectable(const sycl::device &dev) {
+  return dev.get_backend() == sycl::backend::ext_oneapi_level_zero;
+}
+
+// Creates a queue on targetDevice for an execution mode. Queues that
+// execute work get immediate or batched command lists as config asks;
+// queues that only build or record graphs, and queues on backends without
+// the property, are left with the runtime default.
+sycl::queue makeQueue(const queueConfig_t &config, bool executes) {
+  namespace intel_prop = sycl::ext::intel::property::queue;
+  const sycl::device &dev = *targetDevice;
+  if (!executes || !commandListSelectable(dev)) {
+    if (config.inOrder)
+      return sycl::queue{dev, {sycl::property::queue::in_order()}};
+    return sycl::queue{dev};
+  }
+  if (config.immediateCommandList) {
+    if (config.inOrder)
+      return sycl::queue{dev, {sycl::property::queue::in_order(),
+                               intel_prop::immediate_command_list()}};
+    return sycl::queue{dev, {intel_prop::immediate_command_list()}};
+  }
+  if (config.inOrder)
+    return sycl::queue{dev, {sycl::property::queue::in_order(),
+                             intel_prop::no_immediate_command_list()}};
+  return sycl::queue{dev, {intel_prop::no_immediate_command_list()}};
+}
+
+std::string configName(const queueConfig_t &config) {
+  std::string name = config.inOrder ? "in-order" : "out-of-order";
+  if (!commandListSelectable(*targetDevice))
+    return name + ", default command lists";
+  return name + (config.immediateCommandList ? ", immediate" : ", batched");
+}
+
+void printLaunchStats(const std::string &mode, const launchStats_t &stats) {
+  printf("%-44s setup %9.3f  submit %9.2f (us)  first %9.3f  "
+         "per iter %9.3f  amortized %9.3f (ms)  ",
+         mode.c_str(), stats.setup_ms, stats.submit_us / stats.iterations,
+         stats.first_ms, stats.total_ms / stats.iterations,
+         (stats.setup_ms + stats.total_ms) / stats.iterations);
+  if (stats.iterations > 1)
+    printf("steady %10.1f iterations/s\n",
+           (stats.iterations - 1) /
+               ((stats.total_ms - stats.first_ms) * 1e-3f));
+  else
+    printf("steady %10s\n", "-");
+}
 
+// Eager baseline: the pipeline submitted straight to one queue, with each
+// command waiting on the events of the commands it reads from. The CUDA
+// sample forked three streams and joined them with recorded events, which
+// the migration turned into three queues and seven barriers on top of the
+// six real commands; expressing the same DAG as depends_on lists submits
+// only those six. On an in-order queue the event lists are redundant and
+// cost nothing.
+launchStats_t testrun(float *inputVec_h, float *inputVec_d,
+                                  double *outputVec_d, double *result_d,
+                                  size_t inputSize, size_t numOfBlocks,
+                                  const queueConfig_t &config = {},
+                                  const exec_bundle_t *kernels = nullptr) {
+  double result_h = 0.0;
+  auto setupTimer = Time::now();
+  sycl::queue q = makeQueue(config, true);
+  dpct::has_capability_or_fail(q.get_device(), {sycl::aspect::fp64});
+
+  // Each iteration starts once the previous one has copied out its result,
+  // the same ordering the runtime gives successive graph replays.
+  sycl::event ememcpy1;
+  float submit_us = 0.0f, first_ms = 0.0f;
+  auto startTimer = Time::now();
+  for (int i = 0; i < graphLaunchIterations; i++) {
+    auto submitTimer = Time::now();
+/* DPCT_ORIG   checkCudaErrors(cudaMemcpyAsync(inputVec_d, inputVec_h,
+ * sizeof(float) * inputSize, cudaMemcpyDefault, stream1));*/
+    sycl::event ememcpy =
+        q.memcpy(inputVec_d, inputVec_h, sizeof(float) * inputSize, ememcpy1);
+/* DPCT_ORIG   checkCudaErrors(cudaMemsetAsync(outputVec_d, 0, sizeof(double) *
+ * numOfBlocks, stream2));*/
+    sycl::event ememset = q.fill(outputVec_d, 0.0, numOfBlocks, ememcpy1);
 /* DPCT_ORIG   checkCudaErrors(cudaMemsetAsync(result_d, 0, sizeof(double),
  * stream3));*/
-  stream3->memset(result_d, 0, sizeof(double));
-/* DPCT_ORIG   checkCudaErrors(cudaEventRecord(memsetEvent2, stream3));*/
-  /*
-  DPCT1012:47: Detected kernel execution time measurement pattern and generated
-  an initial code for time measurements in SYCL. You can change the way time is
-  measured depending on your goals.
-  */
-  /*
-  DPCT1024:48: The original code returned the error code that was further
-  consumed by the program logic. This original code was replaced with 0. You may
-  need to rewrite the program logic consuming the error code.
-  */
-  *memsetEvent2 = stream3->ext_oneapi_submit_barrier();
-
-/* DPCT_ORIG   checkCudaErrors(cudaStreamWaitEvent(stream1, memsetEvent1, 0));*/
-  stream1->ext_oneapi_submit_barrier({*memsetEvent1});
+    sycl::event ememset1 = q.fill(result_d, 0.0, 1, ememcpy1);
 
 /* DPCT_ORIG   reduce<<<numOfBlocks, THREADS_PER_BLOCK, 0, stream1>>>(
       inputVec_d, outputVec_d, inputSize, numOfBlocks);*/
-  /*
-  DPCT1049:7: The work-group size passed to the SYCL kernel may exceed the
-  limit. To get the device limit, query info::device::max_work_group_size.
-  Adjust the work-group size if needed.
-  */
-  {
-    dpct::has_capability_or_fail(stream1->get_device(), {sycl::aspect::fp64});
-    stream1->submit([&](sycl::handler &cgh) {
-      sycl::local_accessor<double, 1> tmp_acc_ct1(
-          sycl::range<1>(THREADS_PER_BLOCK), cgh);
-
-      cgh.parallel_for(
-          sycl::nd_range<3>(sycl::range<3>(1, 1, numOfBlocks) *
-                                sycl::range<3>(1, 1, THREADS_PER_BLOCK),
-                            sycl::range<3>(1, 1, THREADS_PER_BLOCK)),
-          [=](sycl::nd_item<3> item_ct1) [[intel::reqd_sub_group_size(32)]] {
-            reduce(inputVec_d, outputVec_d, inputSize, numOfBlocks, item_ct1,
-                   tmp_acc_ct1.get_pointer());
-          });
+    sycl::event ek1 = q.submit([&](sycl::handler &cgh) {
+      cgh.depends_on({ememcpy, ememset});
+      reduceCommand(inputVec_d, outputVec_d, inputSize, numOfBlocks,
+                    kernels)(cgh);
     });
-  }
-
-/* DPCT_ORIG   checkCudaErrors(cudaStreamWaitEvent(stream1, memsetEvent2, 0));*/
-  stream1->ext_oneapi_submit_barrier({*memsetEvent2});
 
 /* DPCT_ORIG   reduceFinal<<<1, THREADS_PER_BLOCK, 0, stream1>>>(outputVec_d,
    result_d, numOfBlocks);*/
-  /*
-  DPCT1049:8: The work-group size passed to the SYCL kernel may exceed the
-  limit. To get the device limit, query info::device::max_work_group_size.
-  Adjust the work-group size if needed.
-  */
-  {
-    dpct::has_capability_or_fail(stream1->get_device(), {sycl::aspect::fp64});
-    stream1->submit([&](sycl::handler &cgh) {
-      sycl::local_accessor<double, 1> tmp_acc_ct1(
-          sycl::range<1>(THREADS_PER_BLOCK), cgh);
-
-      cgh.parallel_for(
-          sycl::nd_range<3>(sycl::range<3>(1, 1, THREADS_PER_BLOCK),
-                            sycl::range<3>(1, 1, THREADS_PER_BLOCK)),
-          [=](sycl::nd_item<3> item_ct1) [[intel::reqd_sub_group_size(32)]] {
-            reduceFinal(outputVec_d, result_d, numOfBlocks, item_ct1,
-                        tmp_acc_ct1.get_pointer());
-          });
+    sycl::event ek2 = q.submit([&](sycl::handler &cgh) {
+      cgh.depends_on({ek1, ememset1});
+      reduceFinalCommand(outputVec_d, result_d, numOfBlocks, kernels)(cgh);
     });
-  }
+
 /* DPCT_ORIG   checkCudaErrors(cudaMemcpyAsync(&result_h, result_d,
    sizeof(double), cudaMemcpyDefault, stream1));*/
-  stream1->memcpy(&result_h, result_d, sizeof(double));
+    ememcpy1 = q.submit([&](sycl::handler &cgh) {
+      cgh.depends_on(ek2);
+      cgh.memcpy(&result_h, result_d, sizeof(double));
+    });
+    submit_us += std::chrono::duration_cast<float_ms>(
+                     Time::now() - submitTimer).count() * 1e3f;
+    if (i == 0) {
+      ememcpy1.wait();
+      first_ms = std::chrono::duration_cast<float_ms>(
+                     Time::now() - startTimer).count();
+    }
+  }
+  q.wait();
+  auto stopTimer = Time::now();
   printf("Final reduced sum = %lf\n", result_h);
-  
- 
-/* DPCT_ORIG   checkCudaErrors(cudaStreamDestroy(stream1));*/
-  dpct::get_current_device().destroy_queue(stream1);
-/* DPCT_ORIG   checkCudaErrors(cudaStreamDestroy(stream2));*/
-  dpct::get_current_device().destroy_queue(stream2);
-/* DPCT_ORIG   checkCudaErrors(cudaStreamDestroy(stream3));*/
-  dpct::get_current_device().destroy_queue(stream3);
+
+  return {std::chrono::duration_cast<float_ms>(startTimer - setupTimer)
+              .count(),
+          submit_us, first_ms,
+          std::chrono::duration_cast<float_ms>(stopTimer - startTimer)
+              .count(),
+          graphLaunchIterations};
 }
 
-void syclGraphManual(float *inputVec_h, float *inputVec_d,
+launchStats_t syclGraphManual(float *inputVec_h, float *inputVec_d,
                                   double *outputVec_d, double *result_d,
-                                  size_t inputSize, size_t numOfBlocks) {
+                                  size_t inputSize, size_t numOfBlocks,
+                                  const char *dotFile = nullptr,
+                                  const queueConfig_t &config = {},
+                                  const exec_bundle_t *kernels = nullptr) {
                                       
   namespace sycl_ext = sycl::ext::oneapi::experimental;
   double result_h = 0.0;
-  sycl::queue q = sycl::queue{sycl::gpu_selector_v}; //use default sycl queue, which is out of order
+  auto setupTimer = Time::now();
+  sycl::queue q = makeQueue(config, false); //out of order unless config.inOrder
   sycl_ext::command_graph graph(q.get_context(), q.get_device());
   
   auto nodecpy = graph.add([&](sycl::handler& h){
@@ -421,105 +912,95 @@ void syclGraphManual(float *inputVec_h, float *inputVec_d,
   
   auto nodememset1 = graph.add([&](sycl::handler& h){
       //h.memset(outputVec_d, 0, sizeof(double) * numOfBlocks);
-      h.fill(outputVec_d, 0, numOfBlocks);
+      h.fill(outputVec_d, 0.0, numOfBlocks);
   });
 
   auto nodememset2 = graph.add([&](sycl::handler& h){
       //h.memset(result_d, 0, sizeof(double));
-      h.fill(result_d, 0, 1);
+      h.fill(result_d, 0.0, 1);
   }); 
   
-  auto nodek1 = graph.add([&](sycl::handler &cgh) {
-    sycl::local_accessor<double, 1> tmp_acc_ct1(
-      sycl::range<1>(THREADS_PER_BLOCK), cgh);
+  auto nodek1 = graph.add(
+      reduceCommand(inputVec_d, outputVec_d, inputSize, numOfBlocks,
+                    kernels),
+      sycl_ext::property::node::depends_on(nodecpy, nodememset1));
 
-    cgh.parallel_for(
-      sycl::nd_range<3>(sycl::range<3>(1, 1, numOfBlocks) *
-                            sycl::range<3>(1, 1, THREADS_PER_BLOCK),
-                        sycl::range<3>(1, 1, THREADS_PER_BLOCK)),
-      [=](sycl::nd_item<3> item_ct1) [[intel::reqd_sub_group_size(32)]] {
-        reduce(inputVec_d, outputVec_d, inputSize, numOfBlocks, item_ct1,
-               tmp_acc_ct1.get_pointer());
-      });
-  },  sycl_ext::property::node::depends_on(nodecpy, nodememset1));
-  
-  
-  auto nodek2 = graph.add([&](sycl::handler &cgh) {
-    sycl::local_accessor<double, 1> tmp_acc_ct1(
-      sycl::range<1>(THREADS_PER_BLOCK), cgh);
 
-    cgh.parallel_for(
-      sycl::nd_range<3>(sycl::range<3>(1, 1, THREADS_PER_BLOCK),
-                        sycl::range<3>(1, 1, THREADS_PER_BLOCK)),
-      [=](sycl::nd_item<3> item_ct1) [[intel::reqd_sub_group_size(32)]] {
-        reduceFinal(outputVec_d, result_d, numOfBlocks, item_ct1,
-                    tmp_acc_ct1.get_pointer());
-      });
-  }, sycl_ext::property::node::depends_on(nodek1, nodememset2));
-  
-  auto nodecpy1 = graph.add([&](sycl::handler &cgh) {
+  auto nodek2 = graph.add(
+      reduceFinalCommand(outputVec_d, result_d, numOfBlocks, kernels),
+      sycl_ext::property::node::depends_on(nodek1, nodememset2));
+
+  graph.add([&](sycl::handler &cgh) {
       cgh.memcpy(&result_h, result_d, sizeof(double));  
   }, sycl_ext::property::node::depends_on(nodek2));
+
+  if (dotFile) graph.print_graph(dotFile);
+  size_t nodeCount = graph.get_nodes().size();
   
   auto exec_graph = graph.finalize();
   
-  sycl::queue qexec = sycl::queue{sycl::gpu_selector_v, 
-      {sycl::ext::intel::property::queue::no_immediate_command_list()}};
+  sycl::queue qexec = makeQueue(config, true);
   dpct::has_capability_or_fail(qexec.get_device(), {sycl::aspect::fp64});
-  for (int i = 0; i < GRAPH_LAUNCH_ITERATIONS; i++) {
+  // Replays of the same graph are ordered by the runtime, so like testrun
+  // the loop only waits once at the end.
+  float submit_us = 0.0f, first_ms = 0.0f;
+  auto startTimer = Time::now();
+  for (int i = 0; i < graphLaunchIterations; i++) {
+    auto submitTimer = Time::now();
     qexec.submit([&](sycl::handler& cgh) {
       cgh.ext_oneapi_graph(exec_graph);
-    }).wait(); 
-    printf("Final reduced sum = %lf\n", result_h);
+    });
+    submit_us += std::chrono::duration_cast<float_ms>(
+                     Time::now() - submitTimer).count() * 1e3f;
+    if (i == 0) {
+      qexec.wait();
+      first_ms = std::chrono::duration_cast<float_ms>(
+                     Time::now() - startTimer).count();
+    }
   }
-  
+  qexec.wait();
+  auto stopTimer = Time::now();
+  printf("Final reduced sum = %lf\n", result_h);
+
+  return {std::chrono::duration_cast<float_ms>(startTimer - setupTimer)
+              .count(),
+          submit_us, first_ms,
+          std::chrono::duration_cast<float_ms>(stopTimer - startTimer)
+              .count(),
+          graphLaunchIterations, nodeCount};
 }
 
-void syclGraphCaptureQueue(float *inputVec_h, float *inputVec_d,
+launchStats_t syclGraphCaptureQueue(float *inputVec_h, float *inputVec_d,
                                   double *outputVec_d, double *result_d,
-                                  size_t inputSize, size_t numOfBlocks) {
+                                  size_t inputSize, size_t numOfBlocks,
+                                  const char *dotFile = nullptr,
+                                  const queueConfig_t &config = {},
+                                  const exec_bundle_t *kernels = nullptr) {
                                       
   namespace sycl_ext = sycl::ext::oneapi::experimental;
   double result_h = 0.0;
-  sycl::queue q = sycl::queue{sycl::gpu_selector_v}; //use default sycl queue, which is out of order
+  auto setupTimer = Time::now();
+  sycl::queue q = makeQueue(config, false); //out of order unless config.inOrder
   sycl_ext::command_graph graph(q.get_context(), q.get_device());
   
   graph.begin_recording(q);
   
   sycl::event ememcpy = q.memcpy(inputVec_d, inputVec_h, sizeof(float) * inputSize);
   //sycl::event ememset = q.memset(outputVec_d, 0, sizeof(double) * numOfBlocks);
-  sycl::event ememset = q.fill(outputVec_d, 0, numOfBlocks);
+  sycl::event ememset = q.fill(outputVec_d, 0.0, numOfBlocks);
   //sycl::event ememset1 = q.memset(result_d, 0, sizeof(double));
-  sycl::event ememset1 = q.fill(result_d, 0, 1);
+  sycl::event ememset1 = q.fill(result_d, 0.0, 1);
   
   sycl::event ek1 = q.submit([&](sycl::handler &cgh) {
     cgh.depends_on({ememcpy, ememset});
-    sycl::local_accessor<double, 1> tmp_acc_ct1(
-      sycl::range<1>(THREADS_PER_BLOCK), cgh);
-
-    cgh.parallel_for(
-      sycl::nd_range<3>(sycl::range<3>(1, 1, numOfBlocks) *
-                            sycl::range<3>(1, 1, THREADS_PER_BLOCK),
-                        sycl::range<3>(1, 1, THREADS_PER_BLOCK)),
-      [=](sycl::nd_item<3> item_ct1) [[intel::reqd_sub_group_size(32)]] {
-        reduce(inputVec_d, outputVec_d, inputSize, numOfBlocks, item_ct1,
-               tmp_acc_ct1.get_pointer());
-      });
+    reduceCommand(inputVec_d, outputVec_d, inputSize, numOfBlocks,
+                  kernels)(cgh);
   });
-  
-  
+
+
   sycl::event ek2 = q.submit([&](sycl::handler &cgh) {
     cgh.depends_on({ek1, ememset1});
-    sycl::local_accessor<double, 1> tmp_acc_ct1(
-      sycl::range<1>(THREADS_PER_BLOCK), cgh);
-
-    cgh.parallel_for(
-      sycl::nd_range<3>(sycl::range<3>(1, 1, THREADS_PER_BLOCK),
-                        sycl::range<3>(1, 1, THREADS_PER_BLOCK)),
-      [=](sycl::nd_item<3> item_ct1) [[intel::reqd_sub_group_size(32)]] {
-        reduceFinal(outputVec_d, result_d, numOfBlocks, item_ct1,
-                    tmp_acc_ct1.get_pointer());
-      });
+    reduceFinalCommand(outputVec_d, result_d, numOfBlocks, kernels)(cgh);
   });
   
   q.submit([&](sycl::handler &cgh) {
@@ -527,45 +1008,2202 @@ void syclGraphCaptureQueue(float *inputVec_h, float *inputVec_d,
       cgh.memcpy(&result_h, result_d, sizeof(double));  
   });
   graph.end_recording();
+  if (dotFile) graph.print_graph(dotFile);
+  size_t nodeCount = graph.get_nodes().size();
   auto exec_graph = graph.finalize();
   
   
-  sycl::queue qexec = sycl::queue{sycl::gpu_selector_v, 
-      {sycl::ext::intel::property::queue::no_immediate_command_list()}};
+  sycl::queue qexec = makeQueue(config, true);
   dpct::has_capability_or_fail(qexec.get_device(), {sycl::aspect::fp64});
-  for (int i = 0; i < GRAPH_LAUNCH_ITERATIONS; i++) {
+  float submit_us = 0.0f, first_ms = 0.0f;
+  auto startTimer = Time::now();
+  for (int i = 0; i < graphLaunchIterations; i++) {
+    auto submitTimer = Time::now();
     qexec.submit([&](sycl::handler& cgh) {
       cgh.ext_oneapi_graph(exec_graph);
-    }).wait(); 
-    printf("Final reduced sum = %lf\n", result_h);
+    });
+    submit_us += std::chrono::duration_cast<float_ms>(
+                     Time::now() - submitTimer).count() * 1e3f;
+    if (i == 0) {
+      qexec.wait();
+      first_ms = std::chrono::duration_cast<float_ms>(
+                     Time::now() - startTimer).count();
+    }
   }
-  
+  qexec.wait();
+  auto stopTimer = Time::now();
+  printf("Final reduced sum = %lf\n", result_h);
+
+  return {std::chrono::duration_cast<float_ms>(startTimer - setupTimer)
+              .count(),
+          submit_us, first_ms,
+          std::chrono::duration_cast<float_ms>(stopTimer - startTimer)
+              .count(),
+          graphLaunchIterations, nodeCount};
 }
 
-int main(int argc, char **argv) {
-  size_t size = 1 << 24;  // number of elements to reduce
-  size_t maxBlocks = 512;
+// Nodes of the reduction pipeline that callers attach their own nodes to.
+typedef struct reductionNodes {
+  // memcpy of the input to the device, when the pipeline has one
+  std::optional<sycl::ext::oneapi::experimental::node> input;
+  // last node, after which the sum is in result_d and, if given, *result_h
+  sycl::ext::oneapi::experimental::node result;
+} reductionNodes_t;
+
+// Adds the reduction pipeline of syclGraphManual to graph. Each replay
+// leaves the sum of inputVec_h[0, inputSize) in *result_h. Passing a null
+// inputVec_h drops the memcpy node and reduces inputVec_d in place, and a
+// null result_h drops the copy of the sum out of result_d. With fillOutputs
+// false the reduction runs reduceInitOutput instead, which writes every
+// element of outputVec_d itself, and both fill nodes and their edges are
+// left out; reduceFinal already writes result_d unconditionally.
+//
+// The input elements are of type T and accumulated per work-item in Acc;
+// see reduce().
+template <typename T, typename Acc = double>
+reductionNodes_t addReductionNodes(
+    sycl::ext::oneapi::experimental::command_graph<> &graph, T *inputVec_h,
+    T *inputVec_d, double *outputVec_d, double *result_d, double *result_h,
+    size_t inputSize, size_t numOfBlocks, bool fillOutputs = true) {
 
-//   sycl::device dev = dpct::get_default_queue().get_device();
-//   printf("sycl graph support level: %d \n",dev.get_info<sycl::ext::oneapi::experimental::info::device::graph_support>());
+  namespace sycl_ext = sycl::ext::oneapi::experimental;
+  std::optional<sycl_ext::node> nodecpy;
+  if (inputVec_h) {
+    nodecpy = graph.add([&](sycl::handler& h){
+        h.memcpy(inputVec_d, inputVec_h, sizeof(T) * inputSize);
+    });
+  }
 
-     auto dev = sycl::device{sycl::aspect_selector(
-  std::vector{sycl::aspect::fp16})};
+  auto nodek1 =
+      fillOutputs
+          ? graph.add(reduceCommand<T, Acc>(inputVec_d, outputVec_d,
+                                            inputSize, numOfBlocks))
+          : graph.add(reduceInitOutputCommand<T, Acc>(
+                inputVec_d, outputVec_d, inputSize, numOfBlocks));
+  if (nodecpy) graph.make_edge(*nodecpy, nodek1);
+
+  auto nodek2 = graph.add(
+      reduceFinalCommand(outputVec_d, result_d, numOfBlocks),
+      sycl_ext::property::node::depends_on(nodek1));
+
+  if (fillOutputs) {
+    auto nodememset1 = graph.add([&](sycl::handler& h){
+        h.fill(outputVec_d, 0.0, numOfBlocks);
+    });
+    graph.make_edge(nodememset1, nodek1);
 
- // sycl::device dev = dpct::get_default_queue().get_device();
-    
-  auto graph_support_level = dev.get_info<sycl::ext::oneapi::experimental::info::device::graph_support>();
-    
-  printf("sycl graph support level: %d \n", graph_support_level);
-    
-  if (int(graph_support_level) < 1) {
-    printf("Device require sycl graph support level > 0 \n");
-    printf("Exiting program..\n");
+    auto nodememset2 = graph.add([&](sycl::handler& h){
+        h.fill(result_d, 0.0, 1);
+    });
+    graph.make_edge(nodememset2, nodek2);
+  }
+
+  if (!result_h) return {nodecpy, nodek2};
+  auto nodecpy1 = graph.add([&](sycl::handler &cgh) {
+      cgh.memcpy(result_h, result_d, sizeof(double));
+  }, sycl_ext::property::node::depends_on(nodek2));
+  return {nodecpy, nodecpy1};
+}
+
+// The pipeline of addReductionNodes alone, finalized on q's device. The
+// number of nodes in the graph is stored in *nodeCount when given.
+template <typename T, typename Acc>
+exec_graph_t buildTypedReductionGraph(sycl::queue &q, T *inputVec_h,
+                                      T *inputVec_d, double *outputVec_d,
+                                      double *result_d, double *result_h,
+                                      size_t inputSize, size_t numOfBlocks,
+                                      bool fillOutputs = true,
+                                      size_t *nodeCount = nullptr) {
+
+  namespace sycl_ext = sycl::ext::oneapi::experimental;
+  sycl_ext::command_graph graph(q.get_context(), q.get_device());
+  addReductionNodes<T, Acc>(graph, inputVec_h, inputVec_d, outputVec_d,
+                            result_d, result_h, inputSize, numOfBlocks,
+                            fillOutputs);
+  if (nodeCount) *nodeCount = graph.get_nodes().size();
+  return graph.finalize();
+}
+
+exec_graph_t buildReductionGraph(sycl::queue &q, float *inputVec_h,
+                                 float *inputVec_d, double *outputVec_d,
+                                 double *result_d, double *result_h,
+                                 size_t inputSize, size_t numOfBlocks,
+                                 bool fillOutputs = true,
+                                 size_t *nodeCount = nullptr) {
+  return buildTypedReductionGraph<float, double>(
+      q, inputVec_h, inputVec_d, outputVec_d, result_d, result_h, inputSize,
+      numOfBlocks, fillOutputs, nodeCount);
+}
+
+// Milliseconds per replay of exec_graph on q over replays replays, each
+// waited for, after one untimed warm-up replay.
+float replayTime_ms(sycl::queue &q, exec_graph_t &exec_graph, int replays) {
+  q.ext_oneapi_graph(exec_graph).wait();
+  auto startTimer = Time::now();
+  for (int i = 0; i < replays; i++) q.ext_oneapi_graph(exec_graph).wait();
+  auto stopTimer = Time::now();
+  return std::chrono::duration_cast<float_ms>(stopTimer - startTimer)
+             .count() / replays;
+}
+
+// Whether the device reads host memory in place: a CPU device, or an
+// integrated GPU sharing physical memory with the host, so that the staging
+// memcpy node only moves bytes from one place in system memory to another.
+// The device must also support host USM for the reduce node to read it.
+bool preferZeroCopy(const sycl::device &dev) {
+  return dev.has(sycl::aspect::usm_host_allocations) &&
+         (dev.is_cpu() ||
+          dev.get_info<sycl::info::device::host_unified_memory>());
+}
+
+// buildReductionGraph over inputVec_h on the path preferZeroCopy selects
+// for q's device. The zero-copy graph has no memcpy node and its reduce
+// node reads inputVec_h in place, which needs inputVec_h to be host USM of
+// q's context; otherwise the input is staged through inputVec_d.
+exec_graph_t buildHostInputReductionGraph(sycl::queue &q, float *inputVec_h,
+                                          float *inputVec_d,
+                                          double *outputVec_d,
+                                          double *result_d, double *result_h,
+                                          size_t inputSize,
+                                          size_t numOfBlocks) {
+  if (preferZeroCopy(q.get_device()) &&
+      sycl::get_pointer_type(inputVec_h, q.get_context()) ==
+          sycl::usm::alloc::host)
+    return buildReductionGraph(q, nullptr, inputVec_h, outputVec_d, result_d,
+                               result_h, inputSize, numOfBlocks);
+  return buildReductionGraph(q, inputVec_h, inputVec_d, outputVec_d, result_d,
+                             result_h, inputSize, numOfBlocks);
+}
+
+// The reduction graph with myHostNodeCallback appended as a host-task node,
+// which the benchmarked graphs leave out. First the latency from the end of
+// device work to the start of the node is measured: a single_task after the
+// result copy raises a flag in host USM that this thread spins on, and the
+// node timestamps its own entry, so the gap is the runtime's cost of
+// scheduling a host task behind device work. Then the replays are chained
+// off the callback: each node submits the next replay once it has consumed
+// its result, so after the first submission this thread only waits for the
+// last callback.
+void syclGraphHostNodeLatency(float *inputVec_h, float *inputVec_d,
+                              double *outputVec_d, double *result_d,
+                              size_t inputSize, size_t numOfBlocks) {
+
+  namespace sycl_ext = sycl::ext::oneapi::experimental;
+  sycl::queue q = makeQueue({}, false);
+  sycl::queue qexec = makeQueue({}, true);
+  dpct::has_capability_or_fail(qexec.get_device(), {sycl::aspect::fp64});
+  double *result_h = sycl::malloc_host<double>(1, q);
+  unsigned int *done_h = sycl::malloc_host<unsigned int>(1, q);
+  Time::time_point callbackEntered;
+  callBackData_t hostFnData = {"syclGraphHostNodeLatency", result_h};
+  std::optional<exec_graph_t> exec_graph;
+  std::atomic<int> chainRemaining{0};
+  sycl_ext::command_graph graph(q.get_context(), q.get_device());
+
+  reductionNodes_t reduction =
+      addReductionNodes(graph, inputVec_h, inputVec_d, outputVec_d, result_d,
+                        result_h, inputSize, numOfBlocks);
+
+  auto nodedone = graph.add([&](sycl::handler &cgh) {
+      cgh.single_task([=]() { *done_h = 1; });
+  }, sycl_ext::property::node::depends_on(reduction.result));
+
+  graph.add([&](sycl::handler &cgh) {
+      cgh.host_task([&]() {
+        callbackEntered = Time::now();
+        myHostNodeCallback((void *)&hostFnData);
+        // Only submits: waiting on qexec here would block the host task.
+        if (chainRemaining > 0 && --chainRemaining > 0)
+          qexec.ext_oneapi_graph(*exec_graph);
+      });
+  }, sycl_ext::property::node::depends_on(nodedone));
+
+  exec_graph = graph.finalize();
+
+  float min_us = 0.0f, max_us = 0.0f, total_us = 0.0f;
+  for (int i = 0; i < graphLaunchIterations; i++) {
+    __atomic_store_n(done_h, 0u, __ATOMIC_RELEASE);
+    qexec.submit([&](sycl::handler& cgh) {
+      cgh.ext_oneapi_graph(*exec_graph);
+    });
+    while (__atomic_load_n(done_h, __ATOMIC_ACQUIRE) == 0) {
+    }
+    auto deviceDone = Time::now();
+    qexec.wait();
+
+    float latency_us = std::chrono::duration_cast<float_ms>(
+                           callbackEntered - deviceDone).count() * 1e3f;
+    min_us = i == 0 ? latency_us : std::min(min_us, latency_us);
+    max_us = i == 0 ? latency_us : std::max(max_us, latency_us);
+    total_us += latency_us;
+  }
+  printf("Device completion to host node latency : avg %f, min %f, "
+         "max %f (us)\n",
+         total_us / graphLaunchIterations, min_us, max_us);
+
+  chainRemaining = graphLaunchIterations;
+  auto startTimer = Time::now();
+  qexec.ext_oneapi_graph(*exec_graph);
+  while (chainRemaining > 0) std::this_thread::yield();
+  auto stopTimer = Time::now();
+  qexec.wait();
+  printf("Replays chained off the host node : %f (ms) per replay\n",
+         std::chrono::duration_cast<float_ms>(stopTimer - startTimer)
+                 .count() / graphLaunchIterations);
+
+  sycl::free(result_h, q);
+  sycl::free(done_h, q);
+}
+
+// The reduction graph with a histogram node that runs next to reduce, both
+// fed by the same memcpy node.
+void syclGraphHistogram(float *inputVec_h, float *inputVec_d,
+                        double *outputVec_d, double *result_d,
+                        size_t inputSize, size_t numOfBlocks, float lo,
+                        float hi) {
+
+  namespace sycl_ext = sycl::ext::oneapi::experimental;
+  double result_h = 0.0;
+  sycl::queue q = makeQueue({}, false);
+  unsigned int *bins_d = sycl::malloc_device<unsigned int>(HISTOGRAM_BINS, q);
+  unsigned int *bins_h = sycl::malloc_host<unsigned int>(HISTOGRAM_BINS, q);
+  sycl_ext::command_graph graph(q.get_context(), q.get_device());
+
+  reductionNodes_t reduction =
+      addReductionNodes(graph, inputVec_h, inputVec_d, outputVec_d, result_d,
+                        &result_h, inputSize, numOfBlocks);
+
+  auto nodememsetBins = graph.add([&](sycl::handler& h){
+      h.fill(bins_d, 0u, HISTOGRAM_BINS);
+  });
+
+  auto nodehist = graph.add(
+      histogramCommand(inputVec_d, bins_d, inputSize, numOfBlocks, lo, hi),
+      sycl_ext::property::node::depends_on(*reduction.input, nodememsetBins));
+
+  graph.add([&](sycl::handler &cgh) {
+      cgh.memcpy(bins_h, bins_d, sizeof(unsigned int) * HISTOGRAM_BINS);
+  }, sycl_ext::property::node::depends_on(nodehist));
+
+  auto exec_graph = graph.finalize();
+
+  sycl::queue qexec = makeQueue({}, true);
+  dpct::has_capability_or_fail(qexec.get_device(), {sycl::aspect::fp64});
+  auto startTimer = Time::now();
+  for (int i = 0; i < graphLaunchIterations; i++) {
+    qexec.submit([&](sycl::handler& cgh) {
+      cgh.ext_oneapi_graph(exec_graph);
+    }).wait();
+    printf("Final reduced sum = %lf\n", result_h);
+  }
+  auto stopTimer = Time::now();
+  float replay_ms =
+      std::chrono::duration_cast<float_ms>(stopTimer - startTimer).count() /
+      graphLaunchIterations;
+
+  size_t binned = 0, maxBin = 0;
+  for (int b = 0; b < HISTOGRAM_BINS; b++) {
+    binned += bins_h[b];
+    if (bins_h[b] > bins_h[maxBin]) maxBin = b;
+  }
+  printf("Histogram: %zu elements binned, fullest bin %zu holds %.1f%%\n",
+         binned, maxBin, 100.0 * bins_h[maxBin] / inputSize);
+  printf("Graph replay with histogram node : %f (ms)\n", replay_ms);
+
+  // Time the histogram kernel alone so the throughput is not hidden behind
+  // the host-to-device copy that dominates the replay.
+  sycl::queue qprof = sycl::queue{*targetDevice,
+      {sycl::property::queue::enable_profiling()}};
+  qprof.fill(bins_d, 0u, HISTOGRAM_BINS).wait();
+  sycl::event ehist = qprof.submit(
+      histogramCommand(inputVec_d, bins_d, inputSize, numOfBlocks, lo, hi));
+  ehist.wait();
+  double kernel_ns =
+      ehist.get_profiling_info<sycl::info::event_profiling::command_end>() -
+      ehist.get_profiling_info<sycl::info::event_profiling::command_start>();
+  printf("Histogram kernel : %f (ms), %.2f Gelements/s, %.2f GB/s\n",
+         kernel_ns * 1e-6, inputSize / kernel_ns,
+         sizeof(float) * inputSize / kernel_ns);
+
+  sycl::free(bins_d, q);
+  sycl::free(bins_h, q);
+}
+
+// Appends the radix-select top-K chain to graph. The first histogram pass is
+// made to depend on inputReady when given; the returned gather node leaves
+// the K largest values (unordered) in topK_d.
+sycl::ext::oneapi::experimental::node addTopKNodes(
+    sycl::ext::oneapi::experimental::command_graph<> &graph,
+    const sycl::ext::oneapi::experimental::node *inputReady, float *inputVec_d,
+    size_t inputSize, size_t numOfBlocks, topKState_t *state_d,
+    unsigned int *bins_d, float *topK_d, unsigned int k) {
+
+  namespace sycl_ext = sycl::ext::oneapi::experimental;
+
+  auto nodeinit = graph.add([&](sycl::handler &cgh) {
+    cgh.single_task([=]() { topKInit(state_d, k); });
+  });
+
+  auto prev = nodeinit;
+  for (int pass = 0; pass < TOPK_PASSES; pass++) {
+    int shift = 32 - TOPK_RADIX_BITS * (pass + 1);
+    unsigned int *passBins_d = bins_d + pass * TOPK_RADIX_BINS;
+
+    auto nodememset = graph.add([&](sycl::handler& h){
+        h.fill(passBins_d, 0u, TOPK_RADIX_BINS);
+    });
+
+    auto nodehist = graph.add([&](sycl::handler &cgh) {
+      sycl::local_accessor<unsigned int, 1> bins_acc_ct1(
+        sycl::range<1>(TOPK_RADIX_BINS), cgh);
+
+      cgh.parallel_for(
+        sycl::nd_range<3>(sycl::range<3>(1, 1, numOfBlocks) *
+                              sycl::range<3>(1, 1, THREADS_PER_BLOCK),
+                          sycl::range<3>(1, 1, THREADS_PER_BLOCK)),
+        [=](sycl::nd_item<3> item_ct1) {
+          topKRadixHistogram(inputVec_d, inputSize, state_d, passBins_d,
+                             shift, item_ct1, bins_acc_ct1.get_pointer());
+        });
+    }, sycl_ext::property::node::depends_on(prev, nodememset));
+    if (pass == 0 && inputReady) graph.make_edge(*inputReady, nodehist);
+
+    prev = graph.add([&](sycl::handler &cgh) {
+      cgh.single_task([=]() { topKSelectDigit(state_d, passBins_d, shift); });
+    }, sycl_ext::property::node::depends_on(nodehist));
+  }
+
+  return graph.add([&](sycl::handler &cgh) {
+    cgh.parallel_for(
+      sycl::nd_range<3>(sycl::range<3>(1, 1, numOfBlocks) *
+                            sycl::range<3>(1, 1, THREADS_PER_BLOCK),
+                        sycl::range<3>(1, 1, THREADS_PER_BLOCK)),
+      [=](sycl::nd_item<3> item_ct1) {
+        topKGather(inputVec_d, inputSize, state_d, topK_d, k, item_ct1);
+      });
+  }, sycl_ext::property::node::depends_on(prev));
+}
+
+// The reduction graph with the top-K chain as a sibling of reduce off the
+// memcpy node, followed by a comparison of the top-K chain alone on the
+// device against a full std::sort of the same input on the host. The host
+// sort is a CPU baseline for the cost of ordering everything, not a device
+// sort.
+void syclGraphTopK(float *inputVec_h, float *inputVec_d, double *outputVec_d,
+                   double *result_d, size_t inputSize, size_t numOfBlocks,
+                   unsigned int k) {
+
+  namespace sycl_ext = sycl::ext::oneapi::experimental;
+  double result_h = 0.0;
+  k = std::min<size_t>(std::min(k, (unsigned int)TOPK_MAX), inputSize);
+  if (k == 0) {
+    printf("No elements to select, skipping top-K mode\n");
+    return;
+  }
+  sycl::queue q = makeQueue({}, false);
+  topKState_t *state_d = sycl::malloc_device<topKState_t>(1, q);
+  unsigned int *bins_d =
+      sycl::malloc_device<unsigned int>(TOPK_PASSES * TOPK_RADIX_BINS, q);
+  float *topK_d = sycl::malloc_device<float>(k, q);
+  float *topK_h = sycl::malloc_host<float>(k, q);
+  sycl_ext::command_graph graph(q.get_context(), q.get_device());
+
+  reductionNodes_t reduction =
+      addReductionNodes(graph, inputVec_h, inputVec_d, outputVec_d, result_d,
+                        &result_h, inputSize, numOfBlocks);
+
+  auto nodegather = addTopKNodes(graph, &*reduction.input, inputVec_d,
+                                 inputSize, numOfBlocks, state_d, bins_d,
+                                 topK_d, k);
+
+  graph.add([&](sycl::handler &cgh) {
+      cgh.memcpy(topK_h, topK_d, sizeof(float) * k);
+  }, sycl_ext::property::node::depends_on(nodegather));
+
+  auto exec_graph = graph.finalize();
+
+  // The same chain on its own, reading the input already on the device.
+  sycl_ext::command_graph topKGraph(q.get_context(), q.get_device());
+  addTopKNodes(topKGraph, nullptr, inputVec_d, inputSize, numOfBlocks,
+               state_d, bins_d, topK_d, k);
+  auto exec_topKGraph = topKGraph.finalize();
+
+  sycl::queue qexec = makeQueue({}, true);
+  dpct::has_capability_or_fail(qexec.get_device(), {sycl::aspect::fp64});
+  for (int i = 0; i < graphLaunchIterations; i++) {
+    qexec.submit([&](sycl::handler& cgh) {
+      cgh.ext_oneapi_graph(exec_graph);
+    }).wait();
+    printf("Final reduced sum = %lf\n", result_h);
+  }
+
+  auto startTimer1 = Time::now();
+  for (int i = 0; i < graphLaunchIterations; i++) {
+    qexec.submit([&](sycl::handler& cgh) {
+      cgh.ext_oneapi_graph(exec_topKGraph);
+    });
+  }
+  qexec.wait();
+  auto stopTimer1 = Time::now();
+  float topK_ms =
+      std::chrono::duration_cast<float_ms>(stopTimer1 - startTimer1).count() /
+      graphLaunchIterations;
+
+  std::vector<float> sorted(inputVec_h, inputVec_h + inputSize);
+  auto startTimer2 = Time::now();
+  std::sort(sorted.begin(), sorted.end(), std::greater<float>());
+  auto stopTimer2 = Time::now();
+  float sort_ms =
+      std::chrono::duration_cast<float_ms>(stopTimer2 - startTimer2).count();
+
+  std::sort(topK_h, topK_h + k, std::greater<float>());
+  bool match = std::equal(topK_h, topK_h + k, sorted.begin());
+  printf("Top-%u %s host sort, largest = %f, K-th = %f\n", k,
+         match ? "matches" : "DOES NOT match", topK_h[0], topK_h[k - 1]);
+  printf("Device top-%u select : %f (ms), %.2f Gelements/s\n", k, topK_ms,
+         inputSize / (topK_ms * 1e6));
+  printf("Host std::sort of all elements (CPU baseline) : %f (ms), "
+         "%.2f Gelements/s\n",
+         sort_ms, inputSize / (sort_ms * 1e6));
+
+  sycl::free(state_d, q);
+  sycl::free(bins_d, q);
+  sycl::free(topK_d, q);
+  sycl::free(topK_h, q);
+}
+
+// dev split into its NUMA domains, or dev alone when it has only one or the
+// runtime cannot partition it by NUMA domain.
+std::vector<sycl::device> numaDomains(const sycl::device &dev) {
+  try {
+    auto subDevices = dev.create_sub_devices<
+        sycl::info::partition_property::partition_by_affinity_domain>(
+        sycl::info::partition_affinity_domain::numa);
+    if (subDevices.size() > 1) return subDevices;
+  } catch (sycl::exception &) {
+    // not partitionable by NUMA domain, use the whole device
+  }
+  return {dev};
+}
+
+// Every device that can run the reduction graph. CPU devices are split into
+// their NUMA domains when the runtime supports it, and GPUs exposed through
+// both Level Zero and OpenCL are only taken once, from Level Zero.
+std::vector<sycl::device> reductionDevices() {
+  namespace sycl_ext = sycl::ext::oneapi::experimental;
+  std::vector<sycl::device> all = sycl::device::get_devices();
+  std::vector<sycl::device> devices;
+
+  bool haveLevelZeroGpu = false;
+  for (auto &dev : all)
+    haveLevelZeroGpu |= dev.is_gpu() &&
+        dev.get_backend() == sycl::backend::ext_oneapi_level_zero;
+
+  for (auto &dev : all) {
+    if (dev.is_gpu() && haveLevelZeroGpu &&
+        dev.get_backend() != sycl::backend::ext_oneapi_level_zero)
+      continue;
+    if (!dev.has(sycl::aspect::fp64) ||
+        int(dev.get_info<sycl_ext::info::device::graph_support>()) < 1)
+      continue;
+    if (dev.is_cpu()) {
+      std::vector<sycl::device> domains = numaDomains(dev);
+      devices.insert(devices.end(), domains.begin(), domains.end());
+      continue;
+    }
+    devices.push_back(dev);
+  }
+  return devices;
+}
+
+// Splits inputVec_h over every device from reductionDevices(), one reduction
+// graph per device on the path preferZeroCopy selects for it, and adds up
+// the partial sums on the host. A first round
+// on an even split measures each device's throughput; the timed round then
+// gives each device a share proportional to it.
+void syclGraphMultiDevice(float *inputVec_h, size_t inputSize,
+                          size_t numOfBlocks) {
+
+  std::vector<sycl::device> devices = reductionDevices();
+  if (devices.empty()) {
+    printf("No device supports the reduction graph\n");
+    return;
+  }
+
+  std::vector<sycl::queue> queues;
+  for (auto &dev : devices) {
+    queues.emplace_back(dev);
+    printf("  device %zu: %s\n", queues.size() - 1,
+           dev.get_info<sycl::info::device::name>().c_str());
+  }
+
+  size_t numDevices = devices.size();
+  std::vector<double> throughput(numDevices, 1.0);
+  std::vector<size_t> sliceSize(numDevices), sliceOffset(numDevices);
+  std::vector<float *> inputVec_d(numDevices);
+  std::vector<double *> outputVec_d(numDevices), result_d(numDevices),
+      result_h(numDevices);
+
+  for (int round = 0; round < 2; round++) {
+    double totalThroughput = 0.0;
+    for (double t : throughput) totalThroughput += t;
+
+    size_t offset = 0;
+    for (size_t d = 0; d < numDevices; d++) {
+      sliceOffset[d] = offset;
+      sliceSize[d] = d + 1 == numDevices
+                         ? inputSize - offset
+                         : size_t(inputSize * throughput[d] / totalThroughput);
+      offset += sliceSize[d];
+    }
+
+    std::vector<exec_graph_t> graphs;
+    for (size_t d = 0; d < numDevices; d++) {
+      sycl::queue &q = queues[d];
+      inputVec_d[d] = sycl::malloc_device<float>(sliceSize[d] + 1, q);
+      outputVec_d[d] = sycl::malloc_device<double>(numOfBlocks, q);
+      result_d[d] = sycl::malloc_device<double>(1, q);
+      result_h[d] = sycl::malloc_host<double>(1, q);
+      graphs.push_back(buildHostInputReductionGraph(
+          q, inputVec_h + sliceOffset[d], inputVec_d[d], outputVec_d[d],
+          result_d[d], result_h[d], sliceSize[d], numOfBlocks));
+      q.ext_oneapi_graph(graphs[d]).wait();
+    }
+
+    if (round == 0) {
+      for (size_t d = 0; d < numDevices; d++) {
+        auto startTimer = Time::now();
+        queues[d].ext_oneapi_graph(graphs[d]).wait();
+        auto stopTimer = Time::now();
+        float replay_ms =
+            std::chrono::duration_cast<float_ms>(stopTimer - startTimer)
+                .count();
+        throughput[d] = sliceSize[d] / std::max(replay_ms, 1e-3f);
+      }
+    } else {
+      auto startTimer = Time::now();
+      double sum = 0.0;
+      for (int i = 0; i < graphLaunchIterations; i++) {
+        for (size_t d = 0; d < numDevices; d++)
+          queues[d].ext_oneapi_graph(graphs[d]);
+        sum = 0.0;
+        for (size_t d = 0; d < numDevices; d++) {
+          queues[d].wait();
+          sum += *result_h[d];
+        }
+        printf("Final reduced sum = %lf\n", sum);
+      }
+      auto stopTimer = Time::now();
+      float replay_ms =
+          std::chrono::duration_cast<float_ms>(stopTimer - startTimer)
+              .count() /
+          graphLaunchIterations;
+
+      for (size_t d = 0; d < numDevices; d++)
+        printf("  device %zu: %zu elements (%.1f%%), %.2f Gelements/s "
+               "measured\n",
+               d, sliceSize[d], 100.0 * sliceSize[d] / inputSize,
+               throughput[d] * 1e-6);
+      printf("Multi-device replay on %zu devices : %f (ms), %.2f GB/s\n",
+             numDevices, replay_ms,
+             sizeof(float) * inputSize / (replay_ms * 1e6));
+    }
+
+    for (size_t d = 0; d < numDevices; d++) {
+      sycl::free(inputVec_d[d], queues[d]);
+      sycl::free(outputVec_d[d], queues[d]);
+      sycl::free(result_d[d], queues[d]);
+      sycl::free(result_h[d], queues[d]);
+    }
+  }
+}
+
+// CPU reduction with one sub-graph per NUMA domain. Each domain's slice of
+// the input is first touched by a kernel running on that domain's
+// sub-device, so its pages are placed on the local node and the replays
+// read it in place instead of copying from inputVec_h. The run is repeated
+// on 1..N domains to show how bandwidth scales across sockets.
+void syclGraphNumaCpu(float *inputVec_h, size_t inputSize,
+                      size_t numOfBlocks) {
+
+  sycl::device cpu;
+  try {
+    cpu = sycl::device{sycl::cpu_selector_v};
+  } catch (sycl::exception &) {
+    printf("No CPU device available\n");
+    return;
+  }
+
+  std::vector<sycl::device> domains = numaDomains(cpu);
+  printf("%zu NUMA domain(s) on %s\n", domains.size(),
+         cpu.get_info<sycl::info::device::name>().c_str());
+
+  float base_ms = 0.0f;
+  for (size_t n = 1; n <= domains.size(); n++) {
+    std::vector<sycl::queue> queues;
+    std::vector<float *> inputVec_d(n);
+    std::vector<double *> outputVec_d(n), result_d(n), result_h(n);
+    std::vector<exec_graph_t> graphs;
+
+    for (size_t d = 0; d < n; d++) {
+      queues.emplace_back(domains[d]);
+      sycl::queue &q = queues[d];
+      size_t offset = inputSize * d / n;
+      size_t sliceSize = inputSize * (d + 1) / n - offset;
+
+      float *slice_d = inputVec_d[d] = sycl::malloc_device<float>(sliceSize, q);
+      double *partials_d = outputVec_d[d] =
+          sycl::malloc_device<double>(numOfBlocks, q);
+      result_d[d] = sycl::malloc_device<double>(1, q);
+      result_h[d] = sycl::malloc_host<double>(1, q);
+
+      q.parallel_for(sycl::range<1>(sliceSize),
+                     [=](sycl::id<1> i) { slice_d[i] = 0.0f; });
+      q.parallel_for(sycl::range<1>(numOfBlocks),
+                     [=](sycl::id<1> i) { partials_d[i] = 0.0; });
+      q.memcpy(slice_d, inputVec_h + offset, sizeof(float) * sliceSize);
+      q.wait();
+
+      graphs.push_back(buildReductionGraph(q, nullptr, inputVec_d[d],
+                                           outputVec_d[d], result_d[d],
+                                           result_h[d], sliceSize,
+                                           numOfBlocks));
+      q.ext_oneapi_graph(graphs[d]).wait();
+    }
+
+    double sum = 0.0;
+    auto startTimer = Time::now();
+    for (int i = 0; i < graphLaunchIterations; i++) {
+      for (size_t d = 0; d < n; d++) queues[d].ext_oneapi_graph(graphs[d]);
+      sum = 0.0;
+      for (size_t d = 0; d < n; d++) {
+        queues[d].wait();
+        sum += *result_h[d];
+      }
+    }
+    auto stopTimer = Time::now();
+    float replay_ms =
+        std::chrono::duration_cast<float_ms>(stopTimer - startTimer).count() /
+        graphLaunchIterations;
+    if (n == 1) base_ms = replay_ms;
+
+    printf("  %zu domain(s): sum = %lf, %f (ms), %.2f GB/s, %.2fx\n", n, sum,
+           replay_ms, sizeof(float) * inputSize / (replay_ms * 1e6),
+           base_ms / replay_ms);
+
+    for (size_t d = 0; d < n; d++) {
+      sycl::free(inputVec_d[d], queues[d]);
+      sycl::free(outputVec_d[d], queues[d]);
+      sycl::free(result_d[d], queues[d]);
+      sycl::free(result_h[d], queues[d]);
+    }
+  }
+}
+
+// Replays the reduction graph with its result published into a host USM
+// ring instead of copied into a stack variable, and consumes the results by
+// polling the completion counter. The host keeps up to RESULT_RING_SLOTS
+// replays in flight and never waits on the queue until the end; the same
+// number of replays with a wait per launch is timed for comparison.
+void syclGraphResultRing(float *inputVec_h, float *inputVec_d,
+                         double *outputVec_d, double *result_d,
+                         size_t inputSize, size_t numOfBlocks,
+                         int replays) {
+
+  namespace sycl_ext = sycl::ext::oneapi::experimental;
+  sycl::queue q = makeQueue({}, false);
+  if (!q.get_device().has(sycl::aspect::usm_atomic_host_allocations)) {
+    printf("Device does not support atomics on host USM, skipping result "
+           "ring mode\n");
+    return;
+  }
+  resultRing_t *ring = sycl::malloc_host<resultRing_t>(1, q);
+  memset(ring, 0, sizeof(resultRing_t));
+  double *result_h = sycl::malloc_host<double>(1, q);
+  sycl_ext::command_graph graph(q.get_context(), q.get_device());
+
+  reductionNodes_t reduction =
+      addReductionNodes(graph, inputVec_h, inputVec_d, outputVec_d, result_d,
+                        nullptr, inputSize, numOfBlocks);
+
+  graph.add([&](sycl::handler &cgh) {
+      cgh.single_task([=]() { publishResult(result_d, ring); });
+  }, sycl_ext::property::node::depends_on(reduction.result));
+
+  auto exec_graph = graph.finalize();
+  auto exec_waitGraph =
+      buildReductionGraph(q, inputVec_h, inputVec_d, outputVec_d, result_d,
+                          result_h, inputSize, numOfBlocks);
+
+  sycl::queue qexec = makeQueue({}, true);
+  dpct::has_capability_or_fail(qexec.get_device(), {sycl::aspect::fp64});
+  qexec.ext_oneapi_graph(exec_waitGraph).wait();
+
+  auto startTimer1 = Time::now();
+  for (int i = 0; i < replays; i++) {
+    qexec.submit([&](sycl::handler& cgh) {
+      cgh.ext_oneapi_graph(exec_waitGraph);
+    }).wait();
+  }
+  auto stopTimer1 = Time::now();
+  float wait_ms =
+      std::chrono::duration_cast<float_ms>(stopTimer1 - startTimer1).count();
+
+  unsigned long long submitted = 0, consumed = 0;
+  double first = 0.0, last = 0.0;
+  auto startTimer2 = Time::now();
+  while (consumed < (unsigned long long)replays) {
+    while (submitted < (unsigned long long)replays &&
+           submitted - consumed < RESULT_RING_SLOTS) {
+      qexec.submit([&](sycl::handler& cgh) {
+        cgh.ext_oneapi_graph(exec_graph);
+      });
+      submitted++;
+    }
+    unsigned long long completed =
+        __atomic_load_n(&ring->completed, __ATOMIC_ACQUIRE);
+    for (; consumed < completed; consumed++) {
+      last = ring->slots[consumed % RESULT_RING_SLOTS];
+      if (consumed == 0) first = last;
+    }
+  }
+  auto stopTimer2 = Time::now();
+  qexec.wait();
+  float ring_ms =
+      std::chrono::duration_cast<float_ms>(stopTimer2 - startTimer2).count();
+
+  printf("Result ring: %d results, first = %lf, last = %lf\n", replays, first,
+         last);
+  printf("Wait per launch : %f (ms), %.1f results/s\n", wait_ms,
+         replays / (wait_ms * 1e-3));
+  printf("Result ring     : %f (ms), %.1f results/s\n", ring_ms,
+         replays / (ring_ms * 1e-3));
+
+  sycl::free(ring, q);
+  sycl::free(result_h, q);
+}
+
+// Compares the staged reduction graph against graphs whose reduce node reads
+// the input directly from host or shared USM, with no memcpy node, over a
+// range of input sizes up to inputSize. The last column replays the graph
+// from buildHostInputReductionGraph, the one the other modes use.
+void syclGraphZeroCopy(float *inputVec_h, float *inputVec_d,
+                       double *outputVec_d, double *result_d,
+                       size_t inputSize, size_t numOfBlocks) {
+
+  sycl::queue q = makeQueue({}, false);
+  sycl::device dev = q.get_device();
+  printf("%s: %s path selected\n",
+         dev.get_info<sycl::info::device::name>().c_str(),
+         preferZeroCopy(dev) ? "zero-copy" : "staging copy");
+
+  float *hostVec = sycl::malloc_host<float>(inputSize, q);
+  float *sharedVec = sycl::malloc_shared<float>(inputSize, q);
+  double *result_h = sycl::malloc_host<double>(1, q);
+  memcpy(hostVec, inputVec_h, sizeof(float) * inputSize);
+  memcpy(sharedVec, inputVec_h, sizeof(float) * inputSize);
+
+  sycl::queue qexec = makeQueue({}, true);
+  dpct::has_capability_or_fail(qexec.get_device(), {sycl::aspect::fp64});
+
+  std::vector<size_t> sizes;
+  for (size_t n = std::min<size_t>(1 << 16, inputSize); n < inputSize;
+       n <<= 2)
+    sizes.push_back(n);
+  sizes.push_back(inputSize);
+
+  printf("%12s %14s %14s %14s %14s (ms per replay)\n", "elements", "copy",
+         "host USM", "shared USM", "selected");
+  for (size_t n : sizes) {
+    auto copyGraph = buildReductionGraph(q, hostVec, inputVec_d, outputVec_d,
+                                         result_d, result_h, n, numOfBlocks);
+    auto hostGraph = buildReductionGraph(q, nullptr, hostVec, outputVec_d,
+                                         result_d, result_h, n, numOfBlocks);
+    auto sharedGraph = buildReductionGraph(q, nullptr, sharedVec, outputVec_d,
+                                           result_d, result_h, n,
+                                           numOfBlocks);
+    auto selectedGraph =
+        buildHostInputReductionGraph(q, hostVec, inputVec_d, outputVec_d,
+                                     result_d, result_h, n, numOfBlocks);
+    int replays = graphLaunchIterations;
+    float copy_ms = replayTime_ms(qexec, copyGraph, replays);
+    float host_ms = replayTime_ms(qexec, hostGraph, replays);
+    float shared_ms = replayTime_ms(qexec, sharedGraph, replays);
+    float selected_ms = replayTime_ms(qexec, selectedGraph, replays);
+    printf("%12zu %14f %14f %14f %14f\n", n, copy_ms, host_ms, shared_ms,
+           selected_ms);
+  }
+
+  sycl::free(hostVec, q);
+  sycl::free(sharedVec, q);
+  sycl::free(result_h, q);
+}
+
+// The reduction pipeline of syclGraphManual as a GraphBuilder description.
+// stages > 1 chains further reduce/reduceFinal pairs after the first, each
+// recomputing the same sum, to grow the node count without changing the
+// result. With hostFnData, a host node after the result copy reports the
+// sum through myHostNodeCallback, as the CUDA sample's graph did.
+void describeReductionPipeline(GraphBuilder &pipeline, float *inputVec_h,
+                               float *inputVec_d, double *outputVec_d,
+                               double *result_d, double *result_h,
+                               size_t inputSize, size_t numOfBlocks,
+                               int stages = 1,
+                               callBackData_t *hostFnData = nullptr) {
+  pipeline
+      .copy("memcpy_input", inputVec_d, inputVec_h, sizeof(float) * inputSize)
+      .fill("fill_partials", outputVec_d, 0.0, numOfBlocks)
+      .fill("fill_result", result_d, 0.0, 1)
+      .kernel("reduce",
+              reduceCommand(inputVec_d, outputVec_d, inputSize, numOfBlocks),
+              {"memcpy_input", "fill_partials"})
+      .kernel("reduceFinal",
+              reduceFinalCommand(outputVec_d, result_d, numOfBlocks),
+              {"reduce", "fill_result"});
+
+  std::string last = "reduceFinal";
+  for (int stage = 2; stage <= stages; stage++) {
+    std::string reduceName = "reduce" + std::to_string(stage);
+    std::string finalName = "reduceFinal" + std::to_string(stage);
+    pipeline
+        .kernel(reduceName,
+                reduceCommand(inputVec_d, outputVec_d, inputSize,
+                              numOfBlocks),
+                {last})
+        .kernel(finalName,
+                reduceFinalCommand(outputVec_d, result_d, numOfBlocks),
+                {reduceName});
+    last = finalName;
+  }
+
+  pipeline.copy("memcpy_result", result_h, result_d, sizeof(double), {last});
+  if (hostFnData)
+    pipeline.hostTask("host_callback",
+                      [=] { myHostNodeCallback(hostFnData); },
+                      {"memcpy_result"});
+}
+
+// Runs one GraphBuilder description as eager submissions, as a recorded
+// graph and as a manually built graph, reporting setup and per-iteration
+// cost of each. Setup is the first eager run, or the record/build plus
+// finalize of a graph. The pipeline's host node reports each sum.
+void syclGraphBuilderModes(const GraphBuilder &pipeline) {
+
+  sycl::queue q = makeQueue({}, false);
+  sycl::queue qexec = makeQueue({}, true);
+  dpct::has_capability_or_fail(qexec.get_device(), {sycl::aspect::fp64});
+
+  // Eager submission has no graph to build; its setup is the first, cold
+  // run, which pays for kernel compilation and queue warm-up.
+  printf("Eager submission of %zu nodes ... \n", pipeline.nodes().size());
+  auto startTimer0 = Time::now();
+  pipeline.runEager(q);
+  q.wait();
+  auto stopTimer0 = Time::now();
+  float eagerSetup_ms =
+      std::chrono::duration_cast<float_ms>(stopTimer0 - startTimer0).count();
+  auto startTimer1 = Time::now();
+  for (int i = 0; i < graphLaunchIterations; i++) {
+    pipeline.runEager(q);
+    q.wait();
+  }
+  auto stopTimer1 = Time::now();
+  float eager_ms =
+      std::chrono::duration_cast<float_ms>(stopTimer1 - startTimer1).count() /
+      graphLaunchIterations;
+
+  printf("Recorded graph ... \n");
+  auto startTimer2 = Time::now();
+  exec_graph_t recorded = pipeline.record(q).finalize();
+  auto stopTimer2 = Time::now();
+  float recordSetup_ms =
+      std::chrono::duration_cast<float_ms>(stopTimer2 - startTimer2).count();
+  float record_ms = replayTime_ms(qexec, recorded, graphLaunchIterations);
+
+  printf("Manually built graph ... \n");
+  auto startTimer3 = Time::now();
+  exec_graph_t built =
+      pipeline.build(q.get_context(), q.get_device()).finalize();
+  auto stopTimer3 = Time::now();
+  float buildSetup_ms =
+      std::chrono::duration_cast<float_ms>(stopTimer3 - startTimer3).count();
+  float build_ms = replayTime_ms(qexec, built, graphLaunchIterations);
+
+  printf("%-16s %14s %14s\n", "mode", "setup (ms)", "per iter (ms)");
+  printf("%-16s %14f %14f\n", "eager", eagerSetup_ms, eager_ms);
+  printf("%-16s %14f %14f\n", "recorded graph", recordSetup_ms, record_ms);
+  printf("%-16s %14f %14f\n", "manual graph", buildSetup_ms, build_ms);
+}
+
+// Profiles every node of pipeline through eager submission, writes the DAG
+// to DOT with those durations, and compares the concurrency the DAG allows
+// (total node time over critical path) with what a replay of the manually
+// built graph achieves (total node time over replay time). Node durations
+// are not observable inside a graph replay, so the eager ones stand in.
+void syclGraphAnalyze(const GraphBuilder &pipeline, const char *dotFile) {
+
+  sycl::queue qprof = sycl::queue{*targetDevice,
+      {sycl::property::queue::enable_profiling()}};
+  pipeline.runEager(qprof);
+  qprof.wait();
+  std::vector<sycl::event> events = pipeline.runEager(qprof);
+  qprof.wait();
+
+  const auto &nodes = pipeline.nodes();
+  std::vector<double> durations(nodes.size(), 0.0);
+  double total_ms = 0.0;
+  for (size_t i = 0; i < nodes.size(); i++) {
+    try {
+      durations[i] =
+          (events[i].get_profiling_info<
+               sycl::info::event_profiling::command_end>() -
+           events[i].get_profiling_info<
+               sycl::info::event_profiling::command_start>()) * 1e-6;
+    } catch (sycl::exception &) {
+      // host tasks do not carry profiling information on every backend
+    }
+    total_ms += durations[i];
+  }
+
+  std::vector<size_t> path;
+  double critical_ms = pipeline.criticalPath(durations, &path);
+
+  std::ofstream dot(dotFile);
+  pipeline.writeDot(dot, durations);
+  printf("Wrote %zu-node pipeline to %s\n", nodes.size(), dotFile);
+
+  sycl::queue qexec = makeQueue({}, true);
+  exec_graph_t exec_graph =
+      pipeline.build(qexec.get_context(), qexec.get_device()).finalize();
+  float replay_ms = replayTime_ms(qexec, exec_graph, graphLaunchIterations);
+
+  printf("Critical path:");
+  for (size_t i : path)
+    printf(" %s (%.3f ms)", nodes[i].name.c_str(), durations[i]);
+  printf("\n");
+  printf("Sum of node times   : %f (ms)\n", total_ms);
+  printf("Critical path       : %f (ms)\n", critical_ms);
+  printf("Graph replay        : %f (ms)\n", replay_ms);
+  printf("Theoretical concurrency %.2f, achieved %.2f\n",
+         total_ms / critical_ms, total_ms / replay_ms);
+}
+
+// Preprocess -> reduce -> postprocess, with the finalized reduction graph
+// from buildReductionGraph used unchanged as the middle stage. The three
+// stages are submitted once as separate graphs chained by events and once
+// as a single graph holding each stage as a sub-graph node.
+void syclGraphComposed(float *inputVec_h, float *inputVec_d,
+                       double *outputVec_d, double *result_d,
+                       size_t inputSize, size_t numOfBlocks) {
+
+  namespace sycl_ext = sycl::ext::oneapi::experimental;
+  const float scale = 2.0f;
+  sycl::queue q = makeQueue({}, false);
+  float *staging_d = sycl::malloc_device<float>(inputSize, q);
+  double *mean_d = sycl::malloc_device<double>(1, q);
+  double *result_h = sycl::malloc_host<double>(1, q);
+  double *mean_h = sycl::malloc_host<double>(1, q);
+
+  sycl_ext::command_graph preGraph(q.get_context(), q.get_device());
+  auto nodecpy = preGraph.add([&](sycl::handler& h){
+      h.memcpy(staging_d, inputVec_h, sizeof(float) * inputSize);
+  });
+  preGraph.add([&](sycl::handler &cgh) {
+    cgh.parallel_for(
+      sycl::nd_range<3>(sycl::range<3>(1, 1, numOfBlocks) *
+                            sycl::range<3>(1, 1, THREADS_PER_BLOCK),
+                        sycl::range<3>(1, 1, THREADS_PER_BLOCK)),
+      [=](sycl::nd_item<3> item_ct1) {
+        scaleInput(staging_d, inputVec_d, inputSize, scale, item_ct1);
+      });
+  }, sycl_ext::property::node::depends_on(nodecpy));
+  auto exec_preGraph = preGraph.finalize();
+
+  auto exec_reduceGraph =
+      buildReductionGraph(q, nullptr, inputVec_d, outputVec_d, result_d,
+                          result_h, inputSize, numOfBlocks);
+
+  sycl_ext::command_graph postGraph(q.get_context(), q.get_device());
+  auto nodemean = postGraph.add([&](sycl::handler &cgh) {
+      cgh.single_task([=]() { computeMean(result_d, mean_d, inputSize); });
+  });
+  postGraph.add([&](sycl::handler &cgh) {
+      cgh.memcpy(mean_h, mean_d, sizeof(double));
+  }, sycl_ext::property::node::depends_on(nodemean));
+  auto exec_postGraph = postGraph.finalize();
+
+  sycl_ext::command_graph graph(q.get_context(), q.get_device());
+  auto nodepre = graph.add([&](sycl::handler &cgh) {
+      cgh.ext_oneapi_graph(exec_preGraph);
+  });
+  auto nodereduce = graph.add([&](sycl::handler &cgh) {
+      cgh.ext_oneapi_graph(exec_reduceGraph);
+  }, sycl_ext::property::node::depends_on(nodepre));
+  graph.add([&](sycl::handler &cgh) {
+      cgh.ext_oneapi_graph(exec_postGraph);
+  }, sycl_ext::property::node::depends_on(nodereduce));
+  auto exec_graph = graph.finalize();
+
+  sycl::queue qexec = makeQueue({}, true);
+  dpct::has_capability_or_fail(qexec.get_device(), {sycl::aspect::fp64});
+
+  auto runSeparate = [&]() {
+    sycl::event epre = qexec.ext_oneapi_graph(exec_preGraph);
+    sycl::event ereduce = qexec.ext_oneapi_graph(exec_reduceGraph, epre);
+    qexec.ext_oneapi_graph(exec_postGraph, ereduce).wait();
+  };
+  auto runComposed = [&]() { qexec.ext_oneapi_graph(exec_graph).wait(); };
+
+  runSeparate();
+  runComposed();
+
+  auto startTimer1 = Time::now();
+  for (int i = 0; i < graphLaunchIterations; i++) runSeparate();
+  auto stopTimer1 = Time::now();
+  float separate_ms =
+      std::chrono::duration_cast<float_ms>(stopTimer1 - startTimer1).count() /
+      graphLaunchIterations;
+  printf("Separate graphs: sum = %lf, mean = %lf\n", *result_h, *mean_h);
+
+  auto startTimer2 = Time::now();
+  for (int i = 0; i < graphLaunchIterations; i++) runComposed();
+  auto stopTimer2 = Time::now();
+  float composed_ms =
+      std::chrono::duration_cast<float_ms>(stopTimer2 - startTimer2).count() /
+      graphLaunchIterations;
+  printf("Composed graph : sum = %lf, mean = %lf\n", *result_h, *mean_h);
+
+  printf("Back-to-back separate graphs : %f (ms)\n", separate_ms);
+  printf("Composed graph with sub-graph nodes : %f (ms)\n", composed_ms);
+
+  sycl::free(staging_d, q);
+  sycl::free(mean_d, q);
+  sycl::free(result_h, q);
+  sycl::free(mean_h, q);
+}
+
+// Runs pipeline for graphLaunchIterations iterations in one of the three
+// execution strategies, timing it the way the hand-written modes are timed.
+launchStats_t runPipeline(const GraphBuilder &pipeline, bool asGraph,
+                          bool recorded) {
+  auto setupTimer = Time::now();
+  sycl::queue q = makeQueue({}, !asGraph);
+  sycl::queue qexec = q;
+  std::optional<exec_graph_t> exec_graph;
+  if (asGraph) {
+    exec_graph = recorded
+        ? pipeline.record(q).finalize()
+        : pipeline.build(q.get_context(), q.get_device()).finalize();
+    qexec = makeQueue({}, true);
+  }
+
+  std::vector<sycl::event> last;
+  float submit_us = 0.0f, first_ms = 0.0f;
+  auto startTimer = Time::now();
+  for (int i = 0; i < graphLaunchIterations; i++) {
+    auto submitTimer = Time::now();
+    if (asGraph)
+      qexec.ext_oneapi_graph(*exec_graph);
+    else
+      last = pipeline.runEager(qexec, last);
+    submit_us += std::chrono::duration_cast<float_ms>(
+                     Time::now() - submitTimer).count() * 1e3f;
+    if (i == 0) {
+      qexec.wait();
+      first_ms = std::chrono::duration_cast<float_ms>(
+                     Time::now() - startTimer).count();
+    }
+  }
+  qexec.wait();
+  auto stopTimer = Time::now();
+  return {std::chrono::duration_cast<float_ms>(startTimer - setupTimer)
+              .count(),
+          submit_us, first_ms,
+          std::chrono::duration_cast<float_ms>(stopTimer - startTimer)
+              .count(),
+          graphLaunchIterations, asGraph ? pipeline.nodes().size() : 0};
+}
+
+float steadyIteration_ms(const launchStats_t &stats) {
+  return stats.iterations > 1
+             ? (stats.total_ms - stats.first_ms) / (stats.iterations - 1)
+             : stats.total_ms;
+}
+
+// Iterations after which a graph mode has cost less in total than eager
+// submission, or a negative value if its steady-state iterations are not
+// cheaper and it never catches up.
+float breakEvenIterations(const launchStats_t &eager,
+                          const launchStats_t &graph) {
+  float extra_ms =
+      graph.setup_ms + graph.first_ms - eager.setup_ms - eager.first_ms;
+  float saving_ms = steadyIteration_ms(eager) - steadyIteration_ms(graph);
+  if (saving_ms <= 0.0f) return -1.0f;
+  return std::max(1.0f, 1.0f + extra_ms / saving_ms);
+}
+
+void printBreakEvenRow(size_t elements, size_t nodes,
+                       const launchStats_t &eager,
+                       const launchStats_t &manual,
+                       const launchStats_t &recorded) {
+  float manualN = breakEvenIterations(eager, manual);
+  float recordedN = breakEvenIterations(eager, recorded);
+  printf("%10zu %6zu %10.3f %10.3f %10.3f %10.3f %10.3f ", elements, nodes,
+         steadyIteration_ms(eager), manual.setup_ms,
+         steadyIteration_ms(manual), recorded.setup_ms,
+         steadyIteration_ms(recorded));
+  if (manualN < 0)
+    printf("%10s ", "never");
+  else
+    printf("%10.0f ", manualN);
+  if (recordedN < 0)
+    printf("%10s\n", "never");
+  else
+    printf("%10.0f\n", recordedN);
+}
+
+// Break-even replay count of syclGraphManual and syclGraphCaptureQueue
+// against testrun over a range of input sizes, then of built and recorded
+// GraphBuilder pipelines against their eager submission as stages are
+// added to the pipeline.
+void crossoverAnalysis(float *inputVec_h, float *inputVec_d,
+                       double *outputVec_d, double *result_d,
+                       size_t inputSize, size_t numOfBlocks) {
+  int savedIterations = graphLaunchIterations;
+  graphLaunchIterations = std::max(graphLaunchIterations, 10);
+
+  struct row {
+    size_t elements, nodes;
+    launchStats_t eager, manual, recorded;
+  };
+  std::vector<row> rows;
+
+  for (size_t n = 1 << 12; n <= inputSize; n <<= 4) {
+    row r = {n};
+    r.eager = testrun(inputVec_h, inputVec_d, outputVec_d, result_d, n,
+                      numOfBlocks);
+    r.manual = syclGraphManual(inputVec_h, inputVec_d, outputVec_d, result_d,
+                               n, numOfBlocks);
+    r.nodes = r.manual.nodes;
+    r.recorded = syclGraphCaptureQueue(inputVec_h, inputVec_d, outputVec_d,
+                                       result_d, n, numOfBlocks);
+    rows.push_back(r);
+  }
+
+  double *result_h = sycl::malloc_host<double>(1, dpct::get_default_queue());
+  for (int stages = 1; stages <= 64; stages *= 4) {
+    GraphBuilder pipeline;
+    describeReductionPipeline(pipeline, inputVec_h, inputVec_d, outputVec_d,
+                              result_d, result_h, inputSize, numOfBlocks,
+                              stages);
+    row r = {inputSize};
+    r.eager = runPipeline(pipeline, false, false);
+    r.manual = runPipeline(pipeline, true, false);
+    r.nodes = r.manual.nodes;
+    r.recorded = runPipeline(pipeline, true, true);
+    rows.push_back(r);
+  }
+  sycl::free(result_h, dpct::get_default_queue());
+
+  printf("Break-even iterations over %d iterations per mode "
+         "(times in ms):\n", graphLaunchIterations);
+  printf("%10s %6s %10s %10s %10s %10s %10s %10s %10s\n", "elements",
+         "nodes", "eager/it", "man setup", "man/it", "rec setup", "rec/it",
+         "manual N", "recorded N");
+  for (const row &r : rows)
+    printBreakEvenRow(r.elements, r.nodes, r.eager, r.manual, r.recorded);
+
+  graphLaunchIterations = savedIterations;
+}
+
+#define DAG_BLOCKS 8
+
+enum class DagShape { Chain, FanOutIn, Layered };
+
+const char *dagShapeName(DagShape shape) {
+  switch (shape) {
+    case DagShape::Chain: return "chain";
+    case DagShape::FanOutIn: return "fan-out/in";
+    default: return "layered";
+  }
+}
+
+// Parents of each node of a synthetic DAG with the given node count, in
+// topological order. FanOutIn repeats diamonds of width branches between a
+// fork and a join node; Layered draws one to three random parents for each
+// node from the layer of width nodes before it.
+std::vector<std::vector<size_t>> syntheticDagEdges(DagShape shape,
+                                                   size_t nodes, size_t width,
+                                                   std::mt19937 &rng) {
+  std::vector<std::vector<size_t>> parents(nodes);
+  size_t fork = 0;
+  for (size_t i = 1; i < nodes; i++) {
+    switch (shape) {
+      case DagShape::Chain:
+        parents[i] = {i - 1};
+        break;
+      case DagShape::FanOutIn:
+        if (i - fork <= width && i != nodes - 1) {
+          parents[i] = {fork};
+        } else {
+          for (size_t b = fork + 1; b < i; b++) parents[i].push_back(b);
+          if (parents[i].empty()) parents[i].push_back(fork);
+          fork = i;
+        }
+        break;
+      case DagShape::Layered:
+        if (i >= width) {
+          size_t layerStart = (i / width - 1) * width;
+          std::uniform_int_distribution<size_t> pick(0, width - 1);
+          for (int p = 1 + int(rng() % 3); p > 0; p--) {
+            size_t parent = layerStart + pick(rng);
+            if (std::find(parents[i].begin(), parents[i].end(), parent) ==
+                parents[i].end())
+              parents[i].push_back(parent);
+          }
+        }
+        break;
+    }
+  }
+  return parents;
+}
+
+// Fills pipeline with a synthetic DAG whose nodes cycle through reduce,
+// reduceFinal, fill and memcpy. Node i only writes its own DAG_BLOCKS slot
+// of scratch_d, so independent branches never race; reduceFinal and memcpy
+// nodes read the slot of their first parent, and fall back to reduce and
+// fill when they have none.
+void describeSyntheticDag(GraphBuilder &pipeline, DagShape shape,
+                          size_t nodes, float *inputVec_d, double *scratch_d,
+                          size_t inputSize, std::mt19937 &rng) {
+  std::vector<std::vector<size_t>> parents =
+      syntheticDagEdges(shape, nodes, 64, rng);
+  for (size_t i = 0; i < nodes; i++) {
+    std::string name = "n" + std::to_string(i);
+    std::vector<std::string> deps;
+    for (size_t p : parents[i]) deps.push_back("n" + std::to_string(p));
+    double *slot = scratch_d + i * DAG_BLOCKS;
+    double *parentSlot =
+        parents[i].empty() ? nullptr : scratch_d + parents[i][0] * DAG_BLOCKS;
+
+    int type = int(i % 4);
+    if (type == 1 && parentSlot) {
+      pipeline.kernel(name, reduceFinalCommand(parentSlot, slot, DAG_BLOCKS),
+                      deps);
+    } else if (type == 3 && parentSlot) {
+      pipeline.copy(name, slot, parentSlot, sizeof(double) * DAG_BLOCKS,
+                    deps);
+    } else if (type >= 2) {
+      pipeline.fill(name, slot, 0.0, DAG_BLOCKS, deps);
+    } else {
+      pipeline.kernel(
+          name, reduceCommand(inputVec_d, slot, inputSize, DAG_BLOCKS), deps);
+    }
+  }
+}
+
+// Builds synthetic DAGs of 100 to 10,000 nodes in each shape, both with
+// command_graph::add and by recording a queue, and reports construction,
+// finalize and replay time per node.
+void syclGraphDagStress(float *inputVec_d) {
+  const size_t maxNodes = 10000;
+  const size_t inputSize = DAG_BLOCKS * THREADS_PER_BLOCK * 4;
+  sycl::queue q = makeQueue({}, false);
+  sycl::queue qexec = makeQueue({}, true);
+  double *scratch_d =
+      sycl::malloc_device<double>(maxNodes * DAG_BLOCKS, qexec);
+
+  printf("%-10s %-8s %6s %14s %14s %14s\n", "shape", "method", "nodes",
+         "build us/node", "final us/node", "replay us/node");
+  for (DagShape shape :
+       {DagShape::Chain, DagShape::FanOutIn, DagShape::Layered}) {
+    for (size_t nodes : {100, 300, 1000, 3000, 10000}) {
+      std::mt19937 rng(static_cast<unsigned>(nodes));
+      GraphBuilder pipeline;
+      describeSyntheticDag(pipeline, shape, nodes, inputVec_d, scratch_d,
+                           inputSize, rng);
+
+      for (int recorded = 0; recorded <= 1; recorded++) {
+        auto buildTimer = Time::now();
+        GraphBuilder::Graph graph =
+            recorded ? pipeline.record(q)
+                     : pipeline.build(q.get_context(), q.get_device());
+        auto finalizeTimer = Time::now();
+        exec_graph_t exec_graph = graph.finalize();
+        auto warmupTimer = Time::now();
+
+        qexec.ext_oneapi_graph(exec_graph).wait();
+        auto replayTimer = Time::now();
+        for (int i = 0; i < graphLaunchIterations; i++)
+          qexec.ext_oneapi_graph(exec_graph);
+        qexec.wait();
+        auto stopTimer = Time::now();
+
+        float perNode_us = 1e3f / nodes;
+        printf("%-10s %-8s %6zu %14.3f %14.3f %14.3f\n", dagShapeName(shape),
+               recorded ? "record" : "add", nodes,
+               std::chrono::duration_cast<float_ms>(finalizeTimer -
+                                                    buildTimer).count() *
+                   perNode_us,
+               std::chrono::duration_cast<float_ms>(warmupTimer -
+                                                    finalizeTimer).count() *
+                   perNode_us,
+               std::chrono::duration_cast<float_ms>(stopTimer -
+                                                    replayTimer).count() *
+                   perNode_us / graphLaunchIterations);
+      }
+    }
+  }
+  sycl::free(scratch_d, qexec);
+}
+
+#define CONCURRENT_MAX_THREADS 64
+#define CONCURRENT_REPLAYS 100
+
+// Replays the reduction graph from 1 to CONCURRENT_MAX_THREADS host threads
+// at once and reports replays per second. Every thread owns its queue,
+// partial sums, result and host result, and finalizes its own copy of the
+// buildReductionGraph template against them, since sharing the outputs would
+// race. One executable graph could instead be retargeted through dynamic
+// parameters, but every update would then have to be serialized with the
+// other threads' replays, which is what this mode is meant to avoid. Only
+// the input vector, which the graph only reads, is shared. Setup happens
+// before a common start signal so only replays are timed, and the
+// per-replay submission time shows contention inside the runtime.
+void syclGraphConcurrentReplay(float *inputVec_d, size_t inputSize,
+                               size_t numOfBlocks) {
+  printf("%8s %14s %16s %12s\n", "threads", "replays/s", "submit us/replay",
+         "mismatches");
+  double expected = 0.0;
+  for (int threads = 1; threads <= CONCURRENT_MAX_THREADS; threads *= 2) {
+    std::atomic<int> ready{0};
+    std::atomic<bool> start{false};
+    std::vector<double> results(threads);
+    std::vector<float> submit_us(threads);
+    std::vector<std::thread> workers;
+
+    for (int t = 0; t < threads; t++) {
+      workers.emplace_back([&, t] {
+        sycl::queue q = makeQueue({}, true);
+        double *outputVec_d = sycl::malloc_device<double>(numOfBlocks, q);
+        double *result_d = sycl::malloc_device<double>(1, q);
+        double *result_h = sycl::malloc_host<double>(1, q);
+        exec_graph_t exec_graph =
+            buildReductionGraph(q, nullptr, inputVec_d, outputVec_d,
+                                result_d, result_h, inputSize, numOfBlocks);
+
+        ready++;
+        while (!start) std::this_thread::yield();
+
+        for (int i = 0; i < CONCURRENT_REPLAYS; i++) {
+          auto submitTimer = Time::now();
+          sycl::event replay = q.ext_oneapi_graph(exec_graph);
+          submit_us[t] += std::chrono::duration_cast<float_ms>(
+                              Time::now() - submitTimer).count() * 1e3f;
+          replay.wait();
+        }
+        results[t] = *result_h;
+
+        sycl::free(outputVec_d, q);
+        sycl::free(result_d, q);
+        sycl::free(result_h, q);
+      });
+    }
+
+    while (ready < threads) std::this_thread::yield();
+    auto startTimer = Time::now();
+    start = true;
+    for (auto &worker : workers) worker.join();
+    auto stopTimer = Time::now();
+
+    if (threads == 1) expected = results[0];
+    int mismatches = 0;
+    float totalSubmit_us = 0.0f;
+    for (int t = 0; t < threads; t++) {
+      mismatches += results[t] != expected;
+      totalSubmit_us += submit_us[t];
+    }
+    float elapsed_ms =
+        std::chrono::duration_cast<float_ms>(stopTimer - startTimer).count();
+    printf("%8d %14.0f %16.3f %12d\n", threads,
+           threads * CONCURRENT_REPLAYS / elapsed_ms * 1e3f,
+           totalSubmit_us / (threads * CONCURRENT_REPLAYS), mismatches);
+  }
+}
+
+#define SERVICE_MAX_BATCH 256
+#define SERVICE_BATCH_ELEMENTS (1 << 20)
+#define SERVICE_MAX_REQUEST 4096
+#define SERVICE_CLIENTS 64
+
+// Open-loop load on the reduction service at path: rate requests/s spread
+// over SERVICE_CLIENTS connections for the given time, each summing a
+// random slice of inputVec_h. Latencies, in microseconds, are measured from
+// each request's scheduled send time, so a client that falls behind still
+// charges the wait to the service. Replies that disagree with the host sum
+// are counted in *mismatches.
+std::vector<float> serviceLoad(const std::string &path,
+                               const float *inputVec_h, size_t inputSize,
+                               double rate, float seconds, int *mismatches) {
+  std::vector<std::vector<float>> latencies(SERVICE_CLIENTS);
+  std::atomic<int> wrong{0};
+  std::vector<std::thread> clients;
+  auto start = Time::now() + std::chrono::milliseconds(10);
+  auto interval = std::chrono::duration<double>(SERVICE_CLIENTS / rate);
+  size_t perClient = std::max<size_t>(1, rate * seconds / SERVICE_CLIENTS);
+
+  for (int c = 0; c < SERVICE_CLIENTS; c++) {
+    clients.emplace_back([&, c] {
+      int fd = ReductionService::connectTo(path);
+      std::mt19937 rng(c);
+      auto scheduled = start + std::chrono::duration_cast<Time::duration>(
+                                   interval * c / SERVICE_CLIENTS);
+      for (size_t r = 0; r < perClient; r++) {
+        uint32_t count = 256 + rng() % (SERVICE_MAX_REQUEST - 255);
+        const float *data = inputVec_h + rng() % (inputSize - count);
+        double expected = 0.0;
+        for (uint32_t i = 0; i < count; i++) expected += data[i];
+
+        std::this_thread::sleep_until(scheduled);
+        double sum = ReductionService::request(fd, data, count);
+        latencies[c].push_back(
+            std::chrono::duration_cast<float_ms>(Time::now() - scheduled)
+                .count() * 1e3f);
+        if (!(std::fabs(sum - expected) <= 1e-9 * std::fabs(expected)))
+          wrong++;
+        scheduled += std::chrono::duration_cast<Time::duration>(interval);
+      }
+      close(fd);
+    });
+  }
+  for (auto &client : clients) client.join();
+
+  std::vector<float> all;
+  for (auto &l : latencies) all.insert(all.end(), l.begin(), l.end());
+  *mismatches = wrong;
+  return all;
+}
+
+// Serves reduce requests through ReductionService, executing each batch as
+// one replay of a single-node graph that sums every request of the batch
+// in its own work-group. Requests are packed into host USM that the kernel
+// reads directly, which for requests of a few thousand elements costs less
+// than staging the whole batch buffer to the device. A load generator then
+// reports latency percentiles at rising request rates; batchDelay_us is the
+// longest a request waits for others to share its batch.
+void syclGraphService(float *inputVec_h, size_t inputSize,
+                      int batchDelay_us) {
+  namespace sycl_ext = sycl::ext::oneapi::experimental;
+  sycl::queue q = makeQueue({}, true);
+  float *staging_h = sycl::malloc_host<float>(SERVICE_BATCH_ELEMENTS, q);
+  unsigned int *offsets_h =
+      sycl::malloc_host<unsigned int>(SERVICE_MAX_BATCH + 1, q);
+  unsigned int *segments_h = sycl::malloc_host<unsigned int>(1, q);
+  double *results_h = sycl::malloc_host<double>(SERVICE_MAX_BATCH, q);
+
+  sycl_ext::command_graph graph(q.get_context(), q.get_device());
+  graph.add([&](sycl::handler &cgh) {
+    sycl::local_accessor<double, 1> tmp_acc_ct1(
+      sycl::range<1>(THREADS_PER_BLOCK), cgh);
+
+    cgh.parallel_for(
+      sycl::nd_range<3>(sycl::range<3>(1, 1, SERVICE_MAX_BATCH) *
+                            sycl::range<3>(1, 1, THREADS_PER_BLOCK),
+                        sycl::range<3>(1, 1, THREADS_PER_BLOCK)),
+      [=](sycl::nd_item<3> item_ct1) [[intel::reqd_sub_group_size(32)]] {
+        reduceSegments(staging_h, offsets_h, segments_h, results_h, item_ct1,
+                       tmp_acc_ct1.get_pointer());
+      });
+  });
+  exec_graph_t exec_graph = graph.finalize();
+
+  auto executor = [&](std::vector<ReductionService::Request> &batch) {
+    unsigned int offset = 0;
+    for (size_t r = 0; r < batch.size(); r++) {
+      offsets_h[r] = offset;
+      std::copy(batch[r].data.begin(), batch[r].data.end(),
+                staging_h + offset);
+      offset += batch[r].data.size();
+    }
+    offsets_h[batch.size()] = offset;
+    *segments_h = batch.size();
+    q.ext_oneapi_graph(exec_graph).wait();
+    for (size_t r = 0; r < batch.size(); r++)
+      batch[r].result = results_h[r];
+  };
+
+  std::string path =
+      "/tmp/simpleCudaGraphs." + std::to_string(getpid()) + ".sock";
+  {
+    ReductionService service(path, executor,
+                             std::chrono::microseconds(batchDelay_us),
+                             SERVICE_MAX_BATCH, SERVICE_BATCH_ELEMENTS);
+
+    printf("Max batch delay %d us, %d clients\n", batchDelay_us,
+           SERVICE_CLIENTS);
+    printf("%10s %10s %10s %10s %10s %10s %10s %6s\n", "offered/s",
+           "served/s", "p50 us", "p90 us", "p99 us", "max us", "batch",
+           "wrong");
+    for (double rate : {1000.0, 2000.0, 5000.0, 10000.0, 20000.0, 50000.0}) {
+      size_t batches = service.batches(), served = service.served();
+      int mismatches = 0;
+      auto startTimer = Time::now();
+      std::vector<float> latencies =
+          serviceLoad(path, inputVec_h, inputSize, rate, 0.5f, &mismatches);
+      auto stopTimer = Time::now();
+
+      std::sort(latencies.begin(), latencies.end());
+      auto percentile = [&](double p) {
+        return latencies[std::min(latencies.size() - 1,
+                                  size_t(p * latencies.size()))];
+      };
+      float elapsed_ms =
+          std::chrono::duration_cast<float_ms>(stopTimer - startTimer)
+              .count();
+      printf("%10.0f %10.0f %10.1f %10.1f %10.1f %10.1f %10.1f %6d\n", rate,
+             latencies.size() / elapsed_ms * 1e3f, percentile(0.50),
+             percentile(0.90), percentile(0.99), latencies.back(),
+             double(service.served() - served) /
+                 std::max<size_t>(1, service.batches() - batches),
+             mismatches);
+    }
+  }
+
+  sycl::free(staging_h, q);
+  sycl::free(offsets_h, q);
+  sycl::free(segments_h, q);
+  sycl::free(results_h, q);
+}
+
+// Per-job latency of the persistent kernel against replaying the
+// syclGraphManual reduction graph once per job, both on the CPU device and
+// for a range of small job sizes. Jobs are submitted one at a time and
+// waited for, so each measurement is a full round trip. A job that is not
+// picked up within PERSISTENT_TIMEOUT_MS ends the mode.
+void syclGraphPersistentKernel(float *inputVec_h, size_t numOfBlocks) {
+  sycl::queue q;
+  try {
+    q = sycl::queue{sycl::cpu_selector_v};
+  } catch (sycl::exception &) {
+    printf("No CPU device available, skipping persistent kernel mode\n");
+    return;
+  }
+  printf("Persistent kernel device: %s\n",
+         q.get_device().get_info<sycl::info::device::name>().c_str());
+
+  workRing_t *ring = sycl::malloc_host<workRing_t>(1, q);
+  memset(ring, 0, sizeof(workRing_t));
+  float *jobInput_d = sycl::malloc_device<float>(PERSISTENT_MAX_JOB, q);
+  double *outputVec_d = sycl::malloc_device<double>(numOfBlocks, q);
+  double *result_d = sycl::malloc_device<double>(1, q);
+  double *result_h = sycl::malloc_host<double>(1, q);
+  q.memcpy(jobInput_d, inputVec_h, sizeof(float) * PERSISTENT_MAX_JOB).wait();
+
+  sycl::event persistent = q.submit([&](sycl::handler &cgh) {
+    sycl::local_accessor<double, 1> tmp_acc_ct1(
+      sycl::range<1>(THREADS_PER_BLOCK), cgh);
+
+    cgh.parallel_for(
+      sycl::nd_range<3>(sycl::range<3>(1, 1, THREADS_PER_BLOCK),
+                        sycl::range<3>(1, 1, THREADS_PER_BLOCK)),
+      [=](sycl::nd_item<3> item_ct1) [[intel::reqd_sub_group_size(32)]] {
+        persistentReduce(ring, item_ct1, tmp_acc_ct1.get_pointer());
+      });
+  });
+  // Nothing waits on the kernel until the end, so make sure the runtime
+  // does not hold it back before the host starts spinning on the ring.
+  q.ext_oneapi_prod();
+
+  const size_t sizes[] = {256, 4096, PERSISTENT_MAX_JOB};
+  float persistent_us[3];
+  double persistentSum[3];
+  unsigned long long seq = 0;
+  bool stalled = false;
+  for (int s = 0; s < 3 && !stalled; s++) {
+    auto startTimer = Time::now();
+    for (int j = 0; j < PERSISTENT_JOBS; j++, seq++) {
+      workJob_t *job = &ring->jobs[seq % WORK_RING_SLOTS];
+      job->input = jobInput_d;
+      job->size = sizes[s];
+      __atomic_store_n(&job->state, WORK_POSTED, __ATOMIC_RELEASE);
+      auto deadline =
+          Time::now() + std::chrono::milliseconds(PERSISTENT_TIMEOUT_MS);
+      while (__atomic_load_n(&job->state, __ATOMIC_ACQUIRE) != WORK_DONE) {
+        if (Time::now() > deadline) {
+          stalled = true;
+          break;
+        }
+      }
+      if (stalled) {
+        seq++;  // the stop job must not overwrite the pending one
+        break;
+      }
+      persistentSum[s] = job->result;
+    }
+    auto stopTimer = Time::now();
+    persistent_us[s] =
+        std::chrono::duration_cast<float_ms>(stopTimer - startTimer).count() *
+        1e3f / PERSISTENT_JOBS;
+  }
+  workJob_t *stop = &ring->jobs[seq % WORK_RING_SLOTS];
+  stop->input = nullptr;
+  __atomic_store_n(&stop->state, WORK_POSTED, __ATOMIC_RELEASE);
+  persistent.wait();
+
+  if (stalled) {
+    printf("Persistent kernel did not complete a job within %d ms, "
+           "skipping persistent kernel mode\n", PERSISTENT_TIMEOUT_MS);
+    sycl::free(ring, q);
+    sycl::free(jobInput_d, q);
+    sycl::free(outputVec_d, q);
+    sycl::free(result_d, q);
+    sycl::free(result_h, q);
+    return;
+  }
+
+  printf("%10s %16s %16s %14s %14s\n", "elements", "persistent us/job",
+         "graph us/job", "persistent sum", "graph sum");
+  for (int s = 0; s < 3; s++) {
+    exec_graph_t exec_graph =
+        buildReductionGraph(q, nullptr, jobInput_d, outputVec_d, result_d,
+                            result_h, sizes[s], numOfBlocks);
+    float graph_us = replayTime_ms(q, exec_graph, PERSISTENT_JOBS) * 1e3f;
+
+    printf("%10zu %16.3f %16.3f %14lf %14lf\n", sizes[s], persistent_us[s],
+           graph_us, persistentSum[s], *result_h);
+  }
+
+  sycl::free(ring, q);
+  sycl::free(jobInput_d, q);
+  sycl::free(outputVec_d, q);
+  sycl::free(result_d, q);
+  sycl::free(result_h, q);
+}
+
+// Replay latency of the reduction graph with and without its two fill
+// nodes, the version without them running reduceInitOutput.
+void syclGraphNoFill(float *inputVec_h, float *inputVec_d,
+                     double *outputVec_d, double *result_d,
+                     size_t inputSize, size_t numOfBlocks) {
+  sycl::queue q = makeQueue({}, true);
+  double *result_h = sycl::malloc_host<double>(1, q);
+  int replays = std::max(graphLaunchIterations, 100);
+
+  printf("%-14s %6s %14s %14s\n", "graph", "nodes", "replay us",
+         "result");
+  for (int fillOutputs = 1; fillOutputs >= 0; fillOutputs--) {
+    size_t nodes = 0;
+    exec_graph_t exec_graph =
+        buildReductionGraph(q, inputVec_h, inputVec_d, outputVec_d, result_d,
+                            result_h, inputSize, numOfBlocks,
+                            fillOutputs != 0, &nodes);
+    float replay_ms = replayTime_ms(q, exec_graph, replays);
+
+    printf("%-14s %6zu %14.3f %14lf\n",
+           fillOutputs ? "with fills" : "without fills", nodes,
+           replay_ms * 1e3f, *result_h);
+  }
+  sycl::free(result_h, q);
+}
+
+// Reduces init_input_wide data stored as float, sycl::half and bfloat16,
+// each accumulated per work-item in float and in double. Reports the
+// bandwidth of the upload and reduction together, which both move
+// sizeof(T) bytes per element, and the relative error against the float
+// data summed in double on the host.
+void syclGraphHalfInput(size_t inputSize, size_t numOfBlocks) {
+  using bfloat16 = sycl::ext::oneapi::bfloat16;
+  sycl::queue q = makeQueue({}, true);
+  if (!q.get_device().has(sycl::aspect::fp16)) {
+    printf("Device does not support sycl::half, skipping half input mode\n");
+    return;
+  }
+
+  float *floatVec_h = sycl::malloc_host<float>(inputSize, q);
+  sycl::half *halfVec_h = sycl::malloc_host<sycl::half>(inputSize, q);
+  bfloat16 *bf16Vec_h = sycl::malloc_host<bfloat16>(inputSize, q);
+  init_input_wide(floatVec_h, inputSize);
+  double reference = 0.0;
+  for (size_t i = 0; i < inputSize; i++) {
+    halfVec_h[i] = sycl::half(floatVec_h[i]);
+    bf16Vec_h[i] = bfloat16(floatVec_h[i]);
+    reference += floatVec_h[i];
+  }
+  float *floatVec_d = sycl::malloc_device<float>(inputSize, q);
+  sycl::half *halfVec_d = sycl::malloc_device<sycl::half>(inputSize, q);
+  bfloat16 *bf16Vec_d = sycl::malloc_device<bfloat16>(inputSize, q);
+  double *outputVec_d = sycl::malloc_device<double>(numOfBlocks, q);
+  double *result_d = sycl::malloc_device<double>(1, q);
+  double *result_h = sycl::malloc_host<double>(1, q);
+  int replays = std::max(graphLaunchIterations, 20);
+
+  printf("Host reference sum = %lf\n", reference);
+  printf("%-10s %-8s %12s %12s %14s %12s\n", "input", "acc", "replay ms",
+         "GB/s", "sum", "rel error");
+  auto run = [&](const char *input, const char *acc, auto *vec_h, auto *vec_d,
+                 auto accumulator) {
+    using T = std::remove_pointer_t<decltype(vec_h)>;
+    using Acc = decltype(accumulator);
+    exec_graph_t exec_graph = buildTypedReductionGraph<T, Acc>(
+        q, vec_h, vec_d, outputVec_d, result_d, result_h, inputSize,
+        numOfBlocks);
+    float replay_ms = replayTime_ms(q, exec_graph, replays);
+
+    printf("%-10s %-8s %12.3f %12.2f %14lf %12.3e\n", input, acc, replay_ms,
+           2.0 * sizeof(T) * inputSize / (replay_ms * 1e6), *result_h,
+           std::fabs(*result_h - reference) / reference);
+  };
+  run("float", "double", floatVec_h, floatVec_d, double{});
+  run("float", "float", floatVec_h, floatVec_d, float{});
+  run("half", "double", halfVec_h, halfVec_d, double{});
+  run("half", "float", halfVec_h, halfVec_d, float{});
+  run("bfloat16", "double", bf16Vec_h, bf16Vec_d, double{});
+  run("bfloat16", "float", bf16Vec_h, bf16Vec_d, float{});
+
+  sycl::free(floatVec_h, q);
+  sycl::free(halfVec_h, q);
+  sycl::free(bf16Vec_h, q);
+  sycl::free(floatVec_d, q);
+  sycl::free(halfVec_d, q);
+  sycl::free(bf16Vec_d, q);
+  sycl::free(outputVec_d, q);
+  sycl::free(result_d, q);
+  sycl::free(result_h, q);
+}
+
+// Integer counters with the structure our stored counters have: runs of
+// 1 to 32 repeats of a value below 1 << PACKED_BITS that moves by at most
+// 8 from run to run, so every format below encodes them exactly.
+void init_counters(unsigned int *a, size_t size) {
+  int value = 1 << (PACKED_BITS - 1);
+  for (size_t i = 0; i < size;) {
+    value = std::min(std::max(value + rand() % 17 - 8, 0),
+                     (1 << PACKED_BITS) - 1);
+    for (int run = 1 + rand() % 32; run > 0 && i < size; run--)
+      a[i++] = value;
+  }
+}
+
+// Graph that uploads an encoded input and sums it with reduceWith(load),
+// which decodes units [0, units) in the load stage, followed by
+// reduceFinal. reduceWith writes all numOfBlocks partials, so no fill node
+// is needed.
+template <typename Loader>
+exec_graph_t buildDecodingReductionGraph(sycl::queue &q, const void *encoded_h,
+                                         void *encoded_d, size_t bytes,
+                                         Loader load, size_t units,
+                                         double *outputVec_d,
+                                         double *result_d, double *result_h,
+                                         size_t numOfBlocks) {
+  namespace sycl_ext = sycl::ext::oneapi::experimental;
+  sycl_ext::command_graph graph(q.get_context(), q.get_device());
+
+  auto nodecpy = graph.add([&](sycl::handler &h) {
+    h.memcpy(encoded_d, encoded_h, bytes);
+  });
+
+  auto nodek1 = graph.add([&](sycl::handler &cgh) {
+    sycl::local_accessor<double, 1> tmp_acc_ct1(
+      sycl::range<1>(THREADS_PER_BLOCK), cgh);
+
+    cgh.parallel_for(
+      sycl::nd_range<3>(sycl::range<3>(1, 1, numOfBlocks) *
+                            sycl::range<3>(1, 1, THREADS_PER_BLOCK),
+                        sycl::range<3>(1, 1, THREADS_PER_BLOCK)),
+      [=](sycl::nd_item<3> item_ct1) [[intel::reqd_sub_group_size(32)]] {
+        reduceWith<double>(load, outputVec_d, units, numOfBlocks, item_ct1,
+                           tmp_acc_ct1.get_pointer());
+      });
+  }, sycl_ext::property::node::depends_on(nodecpy));
+
+  auto nodek2 = graph.add(
+      reduceFinalCommand(outputVec_d, result_d, numOfBlocks),
+      sycl_ext::property::node::depends_on(nodek1));
+
+  graph.add([&](sycl::handler &cgh) {
+      cgh.memcpy(result_h, result_d, sizeof(double));
+  }, sycl_ext::property::node::depends_on(nodek2));
+
+  return graph.finalize();
+}
+
+// Sums inputSize counters stored bit-packed, as delta blocks and as RLE
+// runs, decoding in the load stage of the reduction, and compares the
+// elements per second with decompressing on the host and reducing the
+// float array through the float reduction graph.
+void syclGraphCompressed(size_t inputSize, size_t numOfBlocks) {
+  sycl::queue q = makeQueue({}, true);
+  int replays = std::max(graphLaunchIterations, 20);
+
+  std::vector<unsigned int> counters(inputSize);
+  init_counters(counters.data(), inputSize);
+  unsigned long long exact = 0;
+  for (unsigned int c : counters) exact += c;
+
+  size_t words = (inputSize * PACKED_BITS + 31) / 32 + 1;
+  unsigned int *packed_h = sycl::malloc_host<unsigned int>(words, q);
+  memset(packed_h, 0, sizeof(unsigned int) * words);
+  for (size_t i = 0; i < inputSize; i++) {
+    size_t bit = i * PACKED_BITS;
+    unsigned long long bits = (unsigned long long)counters[i] << (bit % 32);
+    packed_h[bit / 32] |= (unsigned int)bits;
+    packed_h[bit / 32 + 1] |= (unsigned int)(bits >> 32);
+  }
+
+  size_t blocks = (inputSize + DELTA_BLOCK - 1) / DELTA_BLOCK;
+  deltaBlock_t *delta_h = sycl::malloc_host<deltaBlock_t>(blocks, q);
+  for (size_t b = 0; b < blocks; b++) {
+    delta_h[b].base = counters[b * DELTA_BLOCK];
+    int prev = delta_h[b].base;
+    for (size_t j = 0; j < DELTA_BLOCK; j++) {
+      size_t i = b * DELTA_BLOCK + j;
+      int value = i < inputSize ? counters[i] : prev;
+      delta_h[b].deltas[j] = value - prev;
+      prev = value;
+    }
+  }
+
+  std::vector<rleRun_t> runs;
+  for (size_t i = 0; i < inputSize; i++) {
+    if (runs.empty() || runs.back().value != counters[i])
+      runs.push_back({counters[i], 0});
+    runs.back().length++;
+  }
+  rleRun_t *rle_h = sycl::malloc_host<rleRun_t>(runs.size(), q);
+  std::copy(runs.begin(), runs.end(), rle_h);
+
+  size_t maxBytes = std::max({sizeof(unsigned int) * words,
+                              sizeof(deltaBlock_t) * blocks,
+                              sizeof(rleRun_t) * runs.size(),
+                              sizeof(float) * inputSize});
+  char *encoded_d = sycl::malloc_device<char>(maxBytes, q);
+  float *decoded_h = sycl::malloc_host<float>(inputSize, q);
+  double *outputVec_d = sycl::malloc_device<double>(numOfBlocks, q);
+  double *result_d = sycl::malloc_device<double>(1, q);
+  double *result_h = sycl::malloc_host<double>(1, q);
+
+  exec_graph_t floatGraph =
+      buildReductionGraph(q, decoded_h, (float *)encoded_d, outputVec_d,
+                          result_d, result_h, inputSize, numOfBlocks);
+  float floatReplay_ms = 0.0f;
+
+  printf("Exact counter sum = %llu\n", exact);
+  printf("%-12s %10s %16s %16s %8s\n", "format", "bytes/elem",
+         "fused Melem/s", "decomp Melem/s", "exact");
+  for (int format = 0; format < 3; format++) {
+    const char *name;
+    size_t bytes;
+    exec_graph_t fused = [&] {
+      switch (format) {
+        case 0:
+          name = "bit-packed";
+          bytes = sizeof(unsigned int) * words;
+          return buildDecodingReductionGraph(
+              q, packed_h, encoded_d, bytes,
+              bitPackedLoader{(const unsigned int *)encoded_d}, inputSize,
+              outputVec_d, result_d, result_h, numOfBlocks);
+        case 1:
+          name = "delta";
+          bytes = sizeof(deltaBlock_t) * blocks;
+          return buildDecodingReductionGraph(
+              q, delta_h, encoded_d, bytes,
+              deltaLoader{(const deltaBlock_t *)encoded_d, inputSize},
+              blocks, outputVec_d, result_d, result_h, numOfBlocks);
+        default:
+          name = "rle";
+          bytes = sizeof(rleRun_t) * runs.size();
+          return buildDecodingReductionGraph(
+              q, rle_h, encoded_d, bytes,
+              rleLoader{(const rleRun_t *)encoded_d}, runs.size(),
+              outputVec_d, result_d, result_h, numOfBlocks);
+      }
+    }();
+    float fused_ms = replayTime_ms(q, fused, replays);
+    bool fusedExact = *result_h == (double)exact;
+
+    auto decodeTimer = Time::now();
+    switch (format) {
+      case 0:
+        for (size_t i = 0; i < inputSize; i++)
+          decoded_h[i] = bitPackedLoader{packed_h}(i);
+        break;
+      case 1:
+        for (size_t i = 0; i < inputSize; i++) {
+          size_t b = i / DELTA_BLOCK, j = i % DELTA_BLOCK;
+          int value = j ? decoded_h[i - 1] : delta_h[b].base;
+          decoded_h[i] = value + delta_h[b].deltas[j];
+        }
+        break;
+      default:
+        for (size_t r = 0, i = 0; r < runs.size(); r++)
+          for (unsigned int k = 0; k < rle_h[r].length; k++)
+            decoded_h[i++] = rle_h[r].value;
+        break;
+    }
+    float decode_ms = std::chrono::duration_cast<float_ms>(
+                          Time::now() - decodeTimer).count();
+    if (format == 0) floatReplay_ms = replayTime_ms(q, floatGraph, replays);
+
+    printf("%-12s %10.2f %16.1f %16.1f %8s\n", name,
+           double(bytes) / inputSize, inputSize / (fused_ms * 1e3),
+           inputSize / ((decode_ms + floatReplay_ms) * 1e3),
+           fusedExact ? "yes" : "no");
+  }
+
+  sycl::free(packed_h, q);
+  sycl::free(delta_h, q);
+  sycl::free(rle_h, q);
+  sycl::free(encoded_d, q);
+  sycl::free(decoded_h, q);
+  sycl::free(outputVec_d, q);
+  sycl::free(result_d, q);
+  sycl::free(result_h, q);
+}
+
+// Launch shape of the specialized reduction kernels, fixed when their
+// kernel bundle is built so the JIT compiler sees them as constants. The
+// work-group size is THREADS_PER_BLOCK, already a compile-time constant.
+constexpr sycl::specialization_id<size_t> inputSizeSpec(0);
+constexpr sycl::specialization_id<size_t> numOfBlocksSpec(0);
+
+class ReduceSpecialized;
+class ReduceFinalSpecialized;
+
+typedef std::pair<size_t, size_t> reductionShape_t;  // inputSize, numOfBlocks
+
+// Executable bundles of the specialized kernels, built once per shape.
+sycl::kernel_bundle<sycl::bundle_state::executable> &specializedKernels(
+    std::map<reductionShape_t,
+             sycl::kernel_bundle<sycl::bundle_state::executable>> &cache,
+    const sycl::queue &q, reductionShape_t shape) {
+  auto it = cache.find(shape);
+  if (it != cache.end()) return it->second;
+
+  auto input = sycl::get_kernel_bundle<sycl::bundle_state::input>(
+      q.get_context(), {q.get_device()},
+      {sycl::get_kernel_id<ReduceSpecialized>(),
+       sycl::get_kernel_id<ReduceFinalSpecialized>()});
+  input.set_specialization_constant<inputSizeSpec>(shape.first);
+  input.set_specialization_constant<numOfBlocksSpec>(shape.second);
+  return cache.emplace(shape, sycl::build(input)).first->second;
+}
+
+// The fill-free reduction graph of buildReductionGraph with the launch
+// shape delivered as specialization constants instead of kernel arguments,
+// so the grid-stride bounds and reduceFinal's combine ladder are resolved
+// when the bundle is compiled.
+exec_graph_t buildSpecializedReductionGraph(
+    sycl::queue &q,
+    sycl::kernel_bundle<sycl::bundle_state::executable> &kernels,
+    float *inputVec_h, float *inputVec_d, double *outputVec_d,
+    double *result_d, double *result_h, size_t inputSize,
+    size_t numOfBlocks) {
+  namespace sycl_ext = sycl::ext::oneapi::experimental;
+  sycl_ext::command_graph graph(q.get_context(), q.get_device());
+
+  auto nodecpy = graph.add([&](sycl::handler &h) {
+    h.memcpy(inputVec_d, inputVec_h, sizeof(float) * inputSize);
+  });
+
+  auto nodek1 = graph.add([&](sycl::handler &cgh) {
+    cgh.use_kernel_bundle(kernels);
+    sycl::local_accessor<double, 1> tmp_acc_ct1(
+      sycl::range<1>(THREADS_PER_BLOCK), cgh);
+
+    cgh.parallel_for<ReduceSpecialized>(
+      sycl::nd_range<3>(sycl::range<3>(1, 1, numOfBlocks) *
+                            sycl::range<3>(1, 1, THREADS_PER_BLOCK),
+                        sycl::range<3>(1, 1, THREADS_PER_BLOCK)),
+      [=](sycl::nd_item<3> item_ct1, sycl::kernel_handler kh)
+          [[intel::reqd_sub_group_size(32)]] {
+        size_t n = kh.get_specialization_constant<inputSizeSpec>();
+        size_t blocks = kh.get_specialization_constant<numOfBlocksSpec>();
+        reduceWith<double>([=](size_t i) { return inputVec_d[i]; },
+                           outputVec_d, n, blocks, item_ct1,
+                           tmp_acc_ct1.get_pointer(), blocks,
+                           THREADS_PER_BLOCK);
+      });
+  }, sycl_ext::property::node::depends_on(nodecpy));
+
+  auto nodek2 = graph.add([&](sycl::handler &cgh) {
+    cgh.use_kernel_bundle(kernels);
+    sycl::local_accessor<double, 1> tmp_acc_ct1(
+      sycl::range<1>(THREADS_PER_BLOCK), cgh);
+
+    cgh.parallel_for<ReduceFinalSpecialized>(
+      sycl::nd_range<3>(sycl::range<3>(1, 1, THREADS_PER_BLOCK),
+                        sycl::range<3>(1, 1, THREADS_PER_BLOCK)),
+      [=](sycl::nd_item<3> item_ct1, sycl::kernel_handler kh)
+          [[intel::reqd_sub_group_size(32)]] {
+        reduceFinal(outputVec_d, result_d,
+                    kh.get_specialization_constant<numOfBlocksSpec>(),
+                    item_ct1, tmp_acc_ct1.get_pointer(),
+                    THREADS_PER_BLOCK);
+      });
+  }, sycl_ext::property::node::depends_on(nodek1));
+
+  graph.add([&](sycl::handler &cgh) {
+      cgh.memcpy(result_h, result_d, sizeof(double));
+  }, sycl_ext::property::node::depends_on(nodek2));
+
+  return graph.finalize();
+}
+
+// Replay time of the fill-free reduction graph with runtime kernel
+// arguments against the specialized graph, for a range of launch shapes.
+// Every shape is run twice so the second pass shows bundle cache hits.
+void syclGraphSpecConstants(float *inputVec_h, float *inputVec_d,
+                            double *outputVec_d, double *result_d,
+                            size_t inputSize, size_t numOfBlocks) {
+  sycl::queue q = makeQueue({}, true);
+  double *result_h = sycl::malloc_host<double>(1, q);
+  int replays = std::max(graphLaunchIterations, 20);
+  std::map<reductionShape_t,
+           sycl::kernel_bundle<sycl::bundle_state::executable>> cache;
+
+  printf("%10s %8s %12s %12s %12s %14s %14s\n", "elements", "blocks",
+         "bundle ms", "runtime ms", "special ms", "runtime sum",
+         "special sum");
+  for (int pass = 0; pass < 2; pass++) {
+    for (size_t n = 1 << 16; n <= inputSize; n <<= 4) {
+      for (size_t blocks = numOfBlocks / 4; blocks <= numOfBlocks;
+           blocks *= 4) {
+        exec_graph_t runtimeGraph =
+            buildReductionGraph(q, inputVec_h, inputVec_d, outputVec_d,
+                                result_d, result_h, n, blocks, false);
+        float runtime_ms = replayTime_ms(q, runtimeGraph, replays);
+        double runtimeSum = *result_h;
+
+        auto bundleTimer = Time::now();
+        auto &kernels = specializedKernels(cache, q, {n, blocks});
+        float bundle_ms = std::chrono::duration_cast<float_ms>(
+                              Time::now() - bundleTimer).count();
+        exec_graph_t specializedGraph = buildSpecializedReductionGraph(
+            q, kernels, inputVec_h, inputVec_d, outputVec_d, result_d,
+            result_h, n, blocks);
+        float special_ms = replayTime_ms(q, specializedGraph, replays);
+
+        printf("%10zu %8zu %12.3f %12.3f %12.3f %14lf %14lf\n", n, blocks,
+               bundle_ms, runtime_ms, special_ms, runtimeSum, *result_h);
+      }
+    }
+  }
+  printf("%zu specialized bundles cached\n", cache.size());
+  sycl::free(result_h, q);
+}
+
+// Turns on the SYCL runtime's persistent cache of compiled device code in
+// dir, unless the environment already configures it. Must run before the
+// first SYCL call, which reads the configuration. Returns "disabled" if the
+// environment turned the cache off, otherwise "warm" or "cold" depending on
+// whether the cache already held binaries.
+const char *enablePersistentJitCache(const char *dir) {
+  setenv("SYCL_CACHE_PERSISTENT", "1", 0);
+  if (strcmp(getenv("SYCL_CACHE_PERSISTENT"), "0") == 0) return "disabled";
+  setenv("SYCL_CACHE_DIR", dir, 0);
+  std::error_code ec;
+  const char *cacheDir = getenv("SYCL_CACHE_DIR");
+  return std::filesystem::exists(cacheDir, ec) &&
+                 !std::filesystem::is_empty(cacheDir, ec)
+             ? "warm"
+             : "cold";
+}
+
+// Builds every kernel of the program for dev in its platform's default
+// context. The queues of all execution modes are created in that context,
+// and the eager and graph modes bind their reduction kernels to the bundle,
+// so their first launches find the kernels already built instead of JIT
+// compiling them. With the persistent cache on, the build itself is a cache
+// load on later starts.
+sycl::kernel_bundle<sycl::bundle_state::executable>
+precompileKernels(const sycl::device &dev) {
+  return sycl::get_kernel_bundle<sycl::bundle_state::executable>(
+      dev.get_platform().ext_oneapi_get_default_context(), {dev});
+}
+
+// One phase of the startup profile.
+typedef struct startupPhase {
+  const char *name;
+  float ms;
+} startupPhase_t;
+
+// Ends the current startup phase: records the time since last under name
+// and starts the next phase now.
+void markPhase(std::vector<startupPhase_t> &phases, Time::time_point &last,
+               const char *name) {
+  auto now = Time::now();
+  phases.push_back(
+      {name, std::chrono::duration_cast<float_ms>(now - last).count()});
+  last = now;
+}
+
+// Prints the startup phases with their share of the time to first result,
+// and writes them as CSV to csvFile when it is not null.
+void reportStartupProfile(const std::vector<startupPhase_t> &phases,
+                          const char *csvFile) {
+  float total_ms = 0.0f;
+  for (const startupPhase_t &phase : phases) total_ms += phase.ms;
+
+  printf("Startup breakdown:\n");
+  for (const startupPhase_t &phase : phases)
+    printf("  %-32s %10.3f (ms) %6.1f%%\n", phase.name, phase.ms,
+           100.0f * phase.ms / total_ms);
+  printf("  %-32s %10.3f (ms)\n", "time to first result", total_ms);
+
+  if (!csvFile) return;
+  std::ofstream csv(csvFile);
+  csv << "phase,ms\n";
+  for (const startupPhase_t &phase : phases)
+    csv << phase.name << "," << phase.ms << "\n";
+  if (csv)
+    printf("Wrote startup breakdown to %s\n", csvFile);
+  else
+    printf("Could not write startup breakdown to %s\n", csvFile);
+}
+
+int main(int argc, char **argv) {
+  auto programStart = Time::now();
+  std::vector<startupPhase_t> startup;
+  auto phaseStart = programStart;
+  size_t size = 1 << 24;  // number of elements to reduce
+  size_t maxBlocks = 512;
+
+  const char *jitCacheState = "off";
+  if (checkCmdLineFlag(argc, (const char **)argv, "jitcache")) {
+    char *dir = nullptr;
+    getCmdLineArgumentString(argc, (const char **)argv, "jitcache", &dir);
+    jitCacheState = enablePersistentJitCache(dir ? dir : "sycl_cache");
+  }
+  markPhase(startup, phaseStart, "argument parsing");
+
+//   sycl::device dev = dpct::get_default_queue().get_device();
+//   printf("sycl graph support level: %d \n",dev.get_info<sycl::ext::oneapi::experimental::info::device::graph_support>());
+
+     auto dev = sycl::device{sycl::aspect_selector(
+  std::vector{sycl::aspect::fp16})};
+  targetDevice = dev;
+  markPhase(startup, phaseStart, "device discovery");
+
+ // sycl::device dev = dpct::get_default_queue().get_device();
+    
+  auto graph_support_level = dev.get_info<sycl::ext::oneapi::experimental::info::device::graph_support>();
+  markPhase(startup, phaseStart, "graph support query");
+    
+  printf("sycl graph support level: %d \n", graph_support_level);
+    
+  if (int(graph_support_level) < 1) {
+    printf("Device require sycl graph support level > 0 \n");
+    printf("Exiting program..\n");
     exit(0);
   }
   printf("%zu elements\n", size);
   printf("threads per block  = %d\n", THREADS_PER_BLOCK);
-  printf("Graph Launch iterations = %d\n", GRAPH_LAUNCH_ITERATIONS);
+  if (checkCmdLineFlag(argc, (const char **)argv, "iterations")) {
+    graphLaunchIterations =
+        getCmdLineArgumentInt(argc, (const char **)argv, "iterations");
+    if (graphLaunchIterations < 1) graphLaunchIterations = 1;
+  }
+  printf("Graph Launch iterations = %d\n", graphLaunchIterations);
 
   float *inputVec_d = NULL, *inputVec_h = NULL;
   double *outputVec_d = NULL, *result_d;  
@@ -580,28 +3218,77 @@ int main(int argc, char **argv) {
   outputVec_d = sycl::malloc_device<double>(maxBlocks, dpct::get_default_queue());
 /* DPCT_ORIG   checkCudaErrors(cudaMalloc(&result_d, sizeof(double)));*/
   result_d = sycl::malloc_device<double>(1, dpct::get_default_queue());
+  markPhase(startup, phaseStart, "USM allocations");
+
+  std::optional<sycl::kernel_bundle<sycl::bundle_state::executable>>
+      kernels;
+  std::thread precompile;
+  auto precompileStart = Time::now(), precompileStop = precompileStart;
+  if (!checkCmdLineFlag(argc, (const char **)argv, "noprecompile")) {
+    precompile = std::thread([&] {
+      try {
+        kernels = precompileKernels(*targetDevice);
+      } catch (sycl::exception &e) {
+        printf("Kernel precompilation failed, kernels are built at first "
+               "launch: %s\n", e.what());
+      }
+      precompileStop = Time::now();
+    });
+  }
 
   init_input(inputVec_h, size);
+  markPhase(startup, phaseStart, "input generation");
 
   double tmp;
   for(size_t i=1;i<size;i++)
       tmp += inputVec_h[i];
   printf("CPU sum = %lf\n", tmp);
+  markPhase(startup, phaseStart, "CPU sum");
+
+  if (precompile.joinable()) {
+    auto joinStart = Time::now();
+    precompile.join();
+    printf("Kernel precompilation: %f (ms), %f (ms) not hidden by input "
+           "generation\n",
+           std::chrono::duration_cast<float_ms>(precompileStop -
+                                                precompileStart).count(),
+           std::chrono::duration_cast<float_ms>(Time::now() - joinStart)
+               .count());
+  }
   
+  const exec_bundle_t *bundle = kernels ? &*kernels : nullptr;
+  bool dumpDot = checkCmdLineFlag(argc, (const char **)argv, "dot");
+
+  markPhase(startup, phaseStart, "kernel precompilation wait");
   printf("Test run on single queue on GPU ... \n");
 
   auto startTimer1 = Time::now();
-  testrun(inputVec_h, inputVec_d, outputVec_d, result_d, size, maxBlocks);
+  launchStats_t stats1 =
+      testrun(inputVec_h, inputVec_d, outputVec_d, result_d, size, maxBlocks,
+              {}, bundle);
   auto stopTimer1 = Time::now();
   auto Timer_duration1 =
       std::chrono::duration_cast<float_ms>(stopTimer1 - startTimer1).count();
 
   printf("Elapsed Time of Single queue on GPU : %f (ms)\n", Timer_duration1);
+  printf("Time to first result: %f (ms) (JIT cache %s)\n",
+         std::chrono::duration_cast<float_ms>(startTimer1 - programStart)
+                 .count() + stats1.setup_ms + stats1.first_ms,
+         jitCacheState);
+  startup.push_back({"queue creation", stats1.setup_ms});
+  startup.push_back({"first iteration and JIT", stats1.first_ms});
+  if (checkCmdLineFlag(argc, (const char **)argv, "startup")) {
+    char *csvFile = nullptr;
+    getCmdLineArgumentString(argc, (const char **)argv, "startup", &csvFile);
+    reportStartupProfile(startup, csvFile);
+  }
 
   printf("Using manually constructed SYCL graph ... \n");
 
   auto startTimer2 = Time::now();
-  syclGraphManual(inputVec_h, inputVec_d, outputVec_d, result_d, size, maxBlocks);
+  launchStats_t stats2 =
+  syclGraphManual(inputVec_h, inputVec_d, outputVec_d, result_d, size, maxBlocks,
+                  dumpDot ? "syclGraphManual.dot" : nullptr, {}, bundle);
   auto stopTimer2 = Time::now();
   auto Timer_duration2 =
       std::chrono::duration_cast<float_ms>(stopTimer2 - startTimer2).count();
@@ -611,14 +3298,201 @@ int main(int argc, char **argv) {
   printf("Using SYCL queue capture on single queue ... \n");
 
   auto startTimer3 = Time::now();
-  syclGraphCaptureQueue(inputVec_h, inputVec_d, outputVec_d, result_d, size, maxBlocks);
+  launchStats_t stats3 =
+  syclGraphCaptureQueue(inputVec_h, inputVec_d, outputVec_d, result_d, size, maxBlocks,
+                        dumpDot ? "syclGraphCaptureQueue.dot" : nullptr, {},
+                        bundle);
   auto stopTimer3 = Time::now();
   auto Timer_duration3 =
       std::chrono::duration_cast<float_ms>(stopTimer3 - startTimer3).count();
 
   printf("Elapsed Time of SYCL queue capture : %f (ms)\n", Timer_duration3);
 
-  
+  printLaunchStats("eager", stats1);
+  printLaunchStats("manual graph", stats2);
+  printLaunchStats("queue capture", stats3);
+
+  bool sweepOrder = checkCmdLineFlag(argc, (const char **)argv, "inorder");
+  bool sweepCommandList =
+      checkCmdLineFlag(argc, (const char **)argv, "cmdlist");
+  if (sweepOrder || sweepCommandList) {
+    if (sweepCommandList &&
+        !commandListSelectable(*targetDevice))
+      printf("Command-list selection is not supported on this backend and "
+             "is ignored\n");
+
+    std::vector<std::string> modes;
+    std::vector<launchStats_t> stats;
+    for (int inOrder = 0; inOrder <= (sweepOrder ? 1 : 0); inOrder++) {
+      for (int immediate = 0; immediate <= (sweepCommandList ? 1 : 0);
+           immediate++) {
+        queueConfig_t config = {inOrder != 0, immediate != 0};
+        std::string name = configName(config);
+        bool baseline = !config.inOrder && !config.immediateCommandList;
+
+        printf("Running all modes with %s queues ... \n", name.c_str());
+        modes.push_back("eager [" + name + "]");
+        stats.push_back(baseline ? stats1
+                                 : testrun(inputVec_h, inputVec_d,
+                                           outputVec_d, result_d, size,
+                                           maxBlocks, config, bundle));
+        modes.push_back("manual graph [" + name + "]");
+        stats.push_back(baseline ? stats2
+                                 : syclGraphManual(inputVec_h, inputVec_d,
+                                                   outputVec_d, result_d,
+                                                   size, maxBlocks, nullptr,
+                                                   config, bundle));
+        modes.push_back("queue capture [" + name + "]");
+        stats.push_back(baseline ? stats3
+                                 : syclGraphCaptureQueue(inputVec_h,
+                                                         inputVec_d,
+                                                         outputVec_d,
+                                                         result_d, size,
+                                                         maxBlocks, nullptr,
+                                                         config, bundle));
+      }
+    }
+    for (size_t m = 0; m < modes.size(); m++)
+      printLaunchStats(modes[m], stats[m]);
+  }
+
+  if (checkCmdLineFlag(argc, (const char **)argv, "histogram")) {
+    float lo = 0.0f, hi = 256.0f / RAND_MAX;
+
+    printf("Using SYCL graph with histogram node (uniform input) ... \n");
+    syclGraphHistogram(inputVec_h, inputVec_d, outputVec_d, result_d, size,
+                       maxBlocks, lo, hi);
+
+    printf("Using SYCL graph with histogram node (90%% skewed input) ... \n");
+    float *skewedVec_h =
+        sycl::malloc_host<float>(size, dpct::get_default_queue());
+    init_input_skewed(skewedVec_h, size, 0.9f);
+    syclGraphHistogram(skewedVec_h, inputVec_d, outputVec_d, result_d, size,
+                       maxBlocks, lo, hi);
+    sycl::free(skewedVec_h, dpct::get_default_queue());
+  }
+
+  if (checkCmdLineFlag(argc, (const char **)argv, "topk")) {
+    int k = getCmdLineArgumentInt(argc, (const char **)argv, "topk");
+    if (k <= 0) k = TOPK_MAX;
+
+    printf("Using SYCL graph with top-K node ... \n");
+    syclGraphTopK(inputVec_h, inputVec_d, outputVec_d, result_d, size,
+                  maxBlocks, k);
+  }
+
+  if (checkCmdLineFlag(argc, (const char **)argv, "multidevice")) {
+    printf("Using SYCL graphs split across all devices ... \n");
+    syclGraphMultiDevice(inputVec_h, size, maxBlocks);
+  }
+
+  if (checkCmdLineFlag(argc, (const char **)argv, "numa")) {
+    printf("Using NUMA-partitioned CPU sub-graphs ... \n");
+    syclGraphNumaCpu(inputVec_h, size, maxBlocks);
+  }
+
+  if (checkCmdLineFlag(argc, (const char **)argv, "hostnodelatency")) {
+    printf("Running the reduction graph with a host node callback ... \n");
+    syclGraphHostNodeLatency(inputVec_h, inputVec_d, outputVec_d, result_d,
+                             size, maxBlocks);
+  }
+
+  if (checkCmdLineFlag(argc, (const char **)argv, "ring")) {
+    int replays = getCmdLineArgumentInt(argc, (const char **)argv, "ring");
+    if (replays <= 0) replays = 100;
+
+    printf("Using SYCL graph with pinned result ring ... \n");
+    syclGraphResultRing(inputVec_h, inputVec_d, outputVec_d, result_d, size,
+                        maxBlocks, replays);
+  }
+
+  if (checkCmdLineFlag(argc, (const char **)argv, "zerocopy")) {
+    printf("Comparing staging copy against zero-copy SYCL graphs ... \n");
+    syclGraphZeroCopy(inputVec_h, inputVec_d, outputVec_d, result_d, size,
+                      maxBlocks);
+  }
+
+  if (checkCmdLineFlag(argc, (const char **)argv, "builder") || dumpDot) {
+    bool builder = checkCmdLineFlag(argc, (const char **)argv, "builder");
+    double *builderResult_h =
+        sycl::malloc_host<double>(1, dpct::get_default_queue());
+    callBackData_t hostFnData = {"syclGraphBuilderModes", builderResult_h};
+    GraphBuilder pipeline;
+    describeReductionPipeline(pipeline, inputVec_h, inputVec_d, outputVec_d,
+                              result_d, builderResult_h, size, maxBlocks, 1,
+                              builder ? &hostFnData : nullptr);
+
+    if (builder) {
+      printf("Running the GraphBuilder pipeline in all three modes ... \n");
+      syclGraphBuilderModes(pipeline);
+    }
+
+    if (dumpDot) {
+      printf("Analyzing the GraphBuilder pipeline ... \n");
+      syclGraphAnalyze(pipeline, "reductionPipeline.dot");
+    }
+    sycl::free(builderResult_h, dpct::get_default_queue());
+  }
+
+  if (checkCmdLineFlag(argc, (const char **)argv, "crossover")) {
+    printf("Measuring graph construction break-even points ... \n");
+    crossoverAnalysis(inputVec_h, inputVec_d, outputVec_d, result_d, size,
+                      maxBlocks);
+  }
+
+  if (checkCmdLineFlag(argc, (const char **)argv, "dagstress")) {
+    printf("Scaling synthetic SYCL graphs from 100 to 10000 nodes ... \n");
+    syclGraphDagStress(inputVec_d);
+  }
+
+  if (checkCmdLineFlag(argc, (const char **)argv, "concurrent")) {
+    printf("Replaying per-thread SYCL graphs from many host threads ... \n");
+    syclGraphConcurrentReplay(inputVec_d, size, maxBlocks);
+  }
+
+  if (checkCmdLineFlag(argc, (const char **)argv, "service")) {
+    int batchDelay_us = 200;
+    if (checkCmdLineFlag(argc, (const char **)argv, "batchdelay"))
+      batchDelay_us = std::max(
+          0, getCmdLineArgumentInt(argc, (const char **)argv, "batchdelay"));
+
+    printf("Serving batched reductions over a Unix domain socket ... \n");
+    syclGraphService(inputVec_h, size, batchDelay_us);
+  }
+
+  if (checkCmdLineFlag(argc, (const char **)argv, "persistent")) {
+    printf("Comparing a persistent kernel against graph replay ... \n");
+    syclGraphPersistentKernel(inputVec_h, maxBlocks);
+  }
+
+  if (checkCmdLineFlag(argc, (const char **)argv, "nofill")) {
+    printf("Comparing the reduction graph with and without fill nodes ... \n");
+    syclGraphNoFill(inputVec_h, inputVec_d, outputVec_d, result_d, size,
+                    maxBlocks);
+  }
+
+  if (checkCmdLineFlag(argc, (const char **)argv, "half")) {
+    printf("Reducing float, half and bfloat16 copies of wide-range input ... \n");
+    syclGraphHalfInput(size, maxBlocks);
+  }
+
+  if (checkCmdLineFlag(argc, (const char **)argv, "compressed")) {
+    printf("Reducing compressed counters with fused decoders ... \n");
+    syclGraphCompressed(size, maxBlocks);
+  }
+
+  if (checkCmdLineFlag(argc, (const char **)argv, "specconst")) {
+    printf("Comparing runtime arguments with specialization constants ... \n");
+    syclGraphSpecConstants(inputVec_h, inputVec_d, outputVec_d, result_d, size,
+                           maxBlocks);
+  }
+
+  if (checkCmdLineFlag(argc, (const char **)argv, "compose")) {
+    printf("Using the reduction graph as a sub-graph node ... \n");
+    syclGraphComposed(inputVec_h, inputVec_d, outputVec_d, result_d, size,
+                      maxBlocks);
+  }
+
   
 /* DPCT_ORIG   checkCudaErrors(cudaFree(inputVec_d));*/
   sycl::free(inputVec_d, dpct::get_default_queue());